@@ -16,4 +16,8 @@
 #define GDBUS_CPP_ERROR_NAME "org.gdbuscpp.Error"
 #endif
 
+#ifndef GDBUS_CPP_POLICY_ANNOTATION
+#define GDBUS_CPP_POLICY_ANNOTATION "org.gdbuscpp.Policy"
+#endif
+
 #endif /* GDBUS_CPP_COMMON_HPP */
@@ -7,11 +7,68 @@
 #include "common.hpp"
 #include "debugger.hpp"
 #include "error.hpp"
+#include "footprint.hpp"
 #include "interface.hpp"
 #include "object.hpp"
+#include "service.hpp"
+#include "span.hpp"
+#include "tracer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <glib-unix.h>
+#include <mutex>
+#include <thread>
 
 namespace {
 
+class thread_default_context
+{
+public:
+    explicit thread_default_context(GMainContext *context) noexcept
+        : m_context(context)
+    {
+        g_main_context_push_thread_default(m_context);
+    }
+
+    ~thread_default_context()
+    {
+        g_main_context_pop_thread_default(m_context);
+    }
+
+    thread_default_context(const thread_default_context &) = delete;
+    thread_default_context &operator=(const thread_default_context &) = delete;
+
+private:
+    GMainContext *m_context;
+};
+
+class call_scope
+{
+public:
+    call_scope(gdbus::connection *connection,
+               const char *sender,
+               const char *object_path,
+               const char *interface_name,
+               const char *method_name) noexcept
+        : m_connection(connection)
+    {
+        m_connection->enter_call(sender, object_path, interface_name, method_name);
+    }
+
+    ~call_scope()
+    {
+        m_connection->leave_call();
+    }
+
+    call_scope(const call_scope &) = delete;
+    call_scope &operator=(const call_scope &) = delete;
+
+private:
+    gdbus::connection *m_connection;
+};
+
 std::string bus_type_to_string(GBusType bus_type)
 {
     switch (bus_type) {
@@ -35,38 +92,328 @@ std::string append_g_error(const std::string &message, GError *error)
 
 std::string dbus_arguments_to_string(GVariant *arguments)
 {
+#ifdef GDBUS_CPP_BUILD_WITH_DEBUG_LOGGING
     char *variant_as_string = g_variant_print(arguments, true);
 
-    if (!variant_as_string) {
-        return {};
+    if (variant_as_string) {
+        std::string result = variant_as_string;
+        g_free(variant_as_string);
+
+        return result;
+    }
+#else
+    (void) arguments;
+#endif
+
+    return {};
+}
+
+std::size_t c_string_size(const char *value) noexcept
+{
+    return value ? strlen(value) + 1 : 0;
+}
+
+std::size_t annotations_size(GDBusAnnotationInfo **annotations) noexcept
+{
+    std::size_t size = 0;
+
+    for (GDBusAnnotationInfo **it = annotations; it && *it; ++it) {
+        size += sizeof(*it) + sizeof(**it) + c_string_size((*it)->key) + c_string_size((*it)->value)
+                + annotations_size((*it)->annotations);
+    }
+
+    return annotations ? size + sizeof(*annotations) : 0;
+}
+
+std::size_t args_size(GDBusArgInfo **args) noexcept
+{
+    std::size_t size = 0;
+
+    for (GDBusArgInfo **it = args; it && *it; ++it) {
+        size += sizeof(*it) + sizeof(**it) + c_string_size((*it)->name)
+                + c_string_size((*it)->signature) + annotations_size((*it)->annotations);
+    }
+
+    return args ? size + sizeof(*args) : 0;
+}
+
+std::size_t interface_info_size(const GDBusInterfaceInfo *interface) noexcept
+{
+    std::size_t size = sizeof(*interface) + c_string_size(interface->name)
+                       + annotations_size(interface->annotations);
+
+    for (GDBusMethodInfo **it = interface->methods; it && *it; ++it) {
+        size += sizeof(*it) + sizeof(**it) + c_string_size((*it)->name) + args_size((*it)->in_args)
+                + args_size((*it)->out_args) + annotations_size((*it)->annotations);
+    }
+
+    for (GDBusSignalInfo **it = interface->signals; it && *it; ++it) {
+        size += sizeof(*it) + sizeof(**it) + c_string_size((*it)->name) + args_size((*it)->args)
+                + annotations_size((*it)->annotations);
+    }
+
+    for (GDBusPropertyInfo **it = interface->properties; it && *it; ++it) {
+        size += sizeof(*it) + sizeof(**it) + c_string_size((*it)->name)
+                + c_string_size((*it)->signature) + annotations_size((*it)->annotations);
+    }
+
+    return size;
+}
+
+std::size_t node_info_size(const GDBusNodeInfo *node) noexcept
+{
+    std::size_t size = sizeof(*node) + c_string_size(node->path)
+                       + annotations_size(node->annotations);
+
+    for (GDBusInterfaceInfo **it = node->interfaces; it && *it; ++it) {
+        size += sizeof(*it) + interface_info_size(*it);
+    }
+
+    for (GDBusNodeInfo **it = node->nodes; it && *it; ++it) {
+        size += sizeof(*it) + node_info_size(*it);
     }
 
-    std::string result = variant_as_string;
-    g_free(variant_as_string);
+    return size;
+}
+
+const char *method_policy(const GDBusMethodInfo *method)
+{
+    return g_dbus_annotation_info_lookup(method->annotations, GDBUS_CPP_POLICY_ANNOTATION);
+}
+
+gdbus::span_fields invocation_fields(GDBusMethodInvocation *invocation)
+{
+    return {g_dbus_method_invocation_get_sender(invocation),
+            g_dbus_method_invocation_get_object_path(invocation),
+            g_dbus_method_invocation_get_interface_name(invocation),
+            g_dbus_method_invocation_get_method_name(invocation),
+            g_dbus_message_get_serial(g_dbus_method_invocation_get_message(invocation))};
+}
+
+const char *const trace_receipt_key = "gdbus-cpp-trace-receipt";
 
-    return result;
+struct trace_receipt
+{
+    gint64 time;
+    int thread;
+};
+
+void free_trace_receipt(gpointer userdata)
+{
+    delete static_cast<trace_receipt *>(userdata);
 }
 
-void on_dbus_name_lost(GDBusConnection *, const char *name, gpointer userdata)
+GDBusMessage *on_dbus_message_filter(GDBusConnection *,
+                                     GDBusMessage *message,
+                                     gboolean incoming,
+                                     gpointer userdata)
 {
+    bool tracing = gdbus::tracer::enabled();
+
+    if (!tracing && !static_cast<gdbus::connection *>(userdata)->capturing()) {
+        return message;
+    }
+
+    GDBusMessageType type = g_dbus_message_get_message_type(message);
+
+    if (incoming && type == G_DBUS_MESSAGE_TYPE_METHOD_CALL) {
+        auto *receipt = new trace_receipt{g_get_monotonic_time(), gdbus::span::current_thread()};
+        g_object_set_data_full(G_OBJECT(message), trace_receipt_key, receipt, free_trace_receipt);
+
+        if (!tracing) {
+            return message;
+        }
+
+        gdbus::span::instant("receive",
+                             {g_dbus_message_get_sender(message),
+                              g_dbus_message_get_path(message),
+                              g_dbus_message_get_interface(message),
+                              g_dbus_message_get_member(message),
+                              g_dbus_message_get_serial(message)});
+    }
+    else if (tracing && !incoming
+             && (type == G_DBUS_MESSAGE_TYPE_METHOD_RETURN || type == G_DBUS_MESSAGE_TYPE_ERROR)) {
+        gdbus::span::instant("send",
+                             {g_dbus_message_get_destination(message),
+                              nullptr,
+                              nullptr,
+                              nullptr,
+                              g_dbus_message_get_reply_serial(message)});
+    }
+
+    return message;
+}
+
+gboolean on_trace_flush_signal(gpointer userdata)
+{
+    const std::string &path = *static_cast<std::string *>(userdata);
+
+    try {
+        gdbus::tracer::flush(path);
+        gdbus::debugger() << "Trace flushed to '" << path << "'";
+    }
+    catch (const gdbus::error &error) {
+        gdbus::debugger() << error.message();
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+/* Connections flushing traces on a signal, which keep the process-wide
+ * tracer enabled. */
+std::mutex tracing_mutex;
+std::size_t tracing_connections = 0;
+
+void free_trace_path(gpointer userdata)
+{
+    delete static_cast<std::string *>(userdata);
+}
+
+void on_dbus_connected(GObject *, GAsyncResult *result, gpointer userdata)
+{
+    gdbus::pointer<GError> error;
+    gdbus::pointer<GDBusConnection> bus = g_bus_get_finish(result, &error);
+
+    if (!bus && g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        return;
+    }
+
     gdbus::connection *connection = static_cast<gdbus::connection *>(userdata);
+    connection->on_bus_connected(std::move(bus), std::move(error));
+}
+
+struct drain_state
+{
+    gdbus::connection *connection;
+    std::shared_ptr<gdbus::endpoint> endpoint;
+    gint64 started;
+    gint64 deadline;
+    std::size_t calls;
+};
+
+gboolean on_drain_tick(gpointer userdata)
+{
+    auto *state = static_cast<drain_state *>(userdata);
+    gint64 now = g_get_monotonic_time();
+
+    if (state->endpoint->pending_calls > 0 && now < state->deadline) {
+        return G_SOURCE_CONTINUE;
+    }
+
+    state->connection->finish_handover(state->endpoint,
+                                       state->calls,
+                                       std::chrono::microseconds(now - state->started));
+    return G_SOURCE_REMOVE;
+}
+
+void free_drain_state(gpointer userdata)
+{
+    delete static_cast<drain_state *>(userdata);
+}
+
+const char *const call_owner_key = "gdbus-cpp-call-owner";
+
+void release_call(gpointer userdata)
+{
+    auto *owner = static_cast<std::shared_ptr<gdbus::endpoint> *>(userdata);
+
+    --(*owner)->pending_calls;
+    delete owner;
+}
+
+void track_call(const std::shared_ptr<gdbus::endpoint> &endpoint,
+                GDBusMethodInvocation *invocation) noexcept
+{
+    ++endpoint->pending_calls;
+    g_object_set_data_full(G_OBJECT(invocation),
+                           call_owner_key,
+                           new std::shared_ptr<gdbus::endpoint>(endpoint),
+                           release_call);
+}
+
+const gdbus::endpoint &call_owner(GDBusMethodInvocation *invocation) noexcept
+{
+    return **static_cast<std::shared_ptr<gdbus::endpoint> *>(
+        g_object_get_data(G_OBJECT(invocation), call_owner_key));
+}
+
+void free_endpoint(gpointer userdata)
+{
+    delete static_cast<std::shared_ptr<gdbus::endpoint> *>(userdata);
+}
+
+void on_dbus_name_lost(GDBusConnection *bus, const char *name, gpointer userdata)
+{
+    auto *registration = static_cast<gdbus::connection::name_registration *>(userdata);
+    gdbus::connection *connection = registration->connection;
+
+    if (!bus) {
+        gdbus::debugger() << "DBus name lost with connection"
+                          << "\n   - Bus:  '" << bus_type_to_string(connection->type()) << "'"
+                          << "\n   - Name: '" << name << "'";
+
+        connection->fail(gdbus::error(GDBUS_CPP_ERROR_NAME,
+                                      "Lost '" + std::string(name) + "' name on closed "
+                                          + bus_type_to_string(connection->type())
+                                          + " bus connection"));
+        return;
+    }
+
+    if (!registration->acquired && (registration->flags & G_BUS_NAME_OWNER_FLAGS_DO_NOT_QUEUE)) {
+        gdbus::debugger() << "DBus name is owned by another connection"
+                          << "\n   - Bus:  '" << bus_type_to_string(connection->type()) << "'"
+                          << "\n   - Name: '" << name << "'";
+
+        connection->fail(gdbus::error(GDBUS_CPP_ERROR_NAME,
+                                      "Name '" + std::string(name) + "' is already owned on "
+                                          + bus_type_to_string(connection->type()) + " bus"));
+        return;
+    }
+
+    if (!registration->acquired) {
+        gdbus::debugger() << "DBus name is owned by another connection, waiting in queue"
+                          << "\n   - Bus:  '" << bus_type_to_string(connection->type()) << "'"
+                          << "\n   - Name: '" << name << "'";
+        return;
+    }
+
+    registration->acquired = false;
+    std::shared_ptr<gdbus::endpoint> owner = registration->owner.lock();
+
+    if (!owner) {
+        return;
+    }
 
     gdbus::debugger() << "DBus name lost"
-                      << "\n   - Bus:  '" << bus_type_to_string(connection->type()) << "'"
-                      << "\n   - Name: '" << name << "'";
+                      << "\n   - Bus:   '" << bus_type_to_string(connection->type()) << "'"
+                      << "\n   - Name:  '" << name << "'"
+                      << "\n   - Calls: " << owner->pending_calls << " in flight";
 
-    throw gdbus::error(GDBUS_CPP_ERROR_NAME,
-                       "Lost '" + std::string(name) + "' name on "
-                           + bus_type_to_string(connection->type()) + " bus connection");
+    connection->hand_over(owner);
 }
 
 void on_dbus_name_acquired(GDBusConnection *, const char *name, gpointer userdata)
 {
-    gdbus::connection *connection = static_cast<gdbus::connection *>(userdata);
+    auto *registration = static_cast<gdbus::connection::name_registration *>(userdata);
+    gdbus::connection *connection = registration->connection;
 
     gdbus::debugger() << "DBus name acquired"
                       << "\n   - Bus:  '" << bus_type_to_string(connection->type()) << "'"
                       << "\n   - Name: '" << name << "'";
+
+    registration->acquired = true;
+
+    if (registration->on_acquired) {
+        registration->on_acquired();
+    }
+}
+
+void dispatch_method_call(gdbus::connection *,
+                          GDBusMethodInvocation *invocation,
+                          const gdbus::span_fields &fields)
+{
+    gdbus::span handler("handler", fields);
+    g_dbus_method_invocation_return_dbus_error(invocation, GDBUS_CPP_ERROR_NAME, "Unimplemented");
 }
 
 void process_method_call(GDBusConnection *,
@@ -76,8 +423,33 @@ void process_method_call(GDBusConnection *,
                          const char *method_name,
                          GVariant *arguments,
                          GDBusMethodInvocation *invocation,
-                         gpointer)
+                         gpointer userdata)
 {
+    const auto &endpoint = *static_cast<std::shared_ptr<gdbus::endpoint> *>(userdata);
+    gdbus::connection *connection = endpoint->connection;
+    track_call(endpoint, invocation);
+
+    call_scope scope(connection, sender, object_path, interface_name, method_name);
+    GDBusMessage *message = g_dbus_method_invocation_get_message(invocation);
+    gdbus::span_fields fields = {sender,
+                                 object_path,
+                                 interface_name,
+                                 method_name,
+                                 g_dbus_message_get_serial(message)};
+
+    auto *receipt = static_cast<trace_receipt *>(
+        g_object_get_data(G_OBJECT(message), trace_receipt_key));
+
+    if (receipt) {
+        gdbus::span::async("queue", receipt->time, receipt->thread, fields);
+    }
+
+    gdbus::span dispatch("dispatch", fields);
+
+    if (gdbus::recorder *recorder = connection->recorder()) {
+        recorder->record(invocation, arguments, receipt ? receipt->time : g_get_monotonic_time());
+    }
+
     gdbus::debugger() << "Method call request"
                       << "\n   - Sender:     '" << sender << "'"
                       << "\n   - Object:     '" << object_path << "'"
@@ -85,7 +457,12 @@ void process_method_call(GDBusConnection *,
                       << "\n   - Method:     '" << method_name << "'"
                       << "\n   - Arguments: " << dbus_arguments_to_string(arguments);
 
-    g_dbus_method_invocation_return_dbus_error(invocation, GDBUS_CPP_ERROR_NAME, "Unimplemented");
+    if (method_policy(g_dbus_method_invocation_get_method_info(invocation))) {
+        connection->credentials().resolve(invocation);
+        return;
+    }
+
+    dispatch_method_call(connection, invocation, fields);
 }
 
 GVariant *process_get_property(GDBusConnection *,
@@ -136,18 +513,8 @@ const GDBusInterfaceVTable vtable = {
 
 namespace gdbus {
 
-connection connection::for_bus_with_type(GBusType type)
+std::shared_ptr<connection> connection::for_bus_with_type(GBusType type)
 {
-    gdbus::pointer<GError> error;
-    gdbus::pointer<GDBusConnection> connection = g_bus_get_sync(type, nullptr, &error);
-
-    if (!connection) {
-        throw gdbus::error(GDBUS_CPP_ERROR_NAME,
-                           append_g_error("Couldn't create " + bus_type_to_string(type)
-                                              + " bus connection",
-                                          error));
-    }
-
     gdbus::pointer<GMainContext> context = g_main_context_new();
 
     if (!context) {
@@ -164,32 +531,347 @@ connection connection::for_bus_with_type(GBusType type)
                                + " bus connection");
     }
 
-    return {type, std::move(connection), std::move(context), std::move(mainloop)};
+    std::shared_ptr<gdbus::connection> connection(new gdbus::connection(type,
+                                                                        std::move(context),
+                                                                        std::move(mainloop),
+                                                                        g_cancellable_new()));
+    connection->connect();
+
+    return connection;
 }
 
 connection::connection(GBusType type,
-                       gdbus::pointer<GDBusConnection> connection,
                        gdbus::pointer<GMainContext> context,
-                       gdbus::pointer<GMainLoop> mainloop) noexcept
+                       gdbus::pointer<GMainLoop> mainloop,
+                       gdbus::pointer<GCancellable> cancellable) noexcept
     : m_type(type)
-    , m_connection(std::move(connection))
     , m_context(std::move(context))
     , m_mainloop(std::move(mainloop))
-    , m_name_registration(0)
+    , m_cancellable(std::move(cancellable))
+    , m_connect_started(0)
+    , m_connect_finished(0)
+    , m_max_priority(G_PRIORITY_DEFAULT)
+    , m_filter(0)
+    , m_trace_flush_source(nullptr)
+    , m_watchdog_owner(nullptr)
+    , m_recorder_owner(nullptr)
+    , m_capturing(false)
+    , m_tracing_owner(nullptr)
+    , m_thread(std::thread::id())
+    , m_running(false)
+    , m_credentials([this](GDBusMethodInvocation *invocation,
+                           const gdbus::credentials *credentials) {
+        authorize(invocation, credentials);
+    })
+{}
+
+connection::~connection()
 {
-    g_main_context_push_thread_default(m_context);
+    stop();
+    g_cancellable_cancel(m_cancellable);
+    stop_tracing();
+
+    if (m_filter) {
+        g_dbus_connection_remove_filter(m_connection, m_filter);
+    }
+
+    for (const auto &registration: m_registrations) {
+        g_dbus_connection_unregister_object(m_connection, registration.id);
+    }
+
+    for (const auto &[name, registration]: m_names) {
+        g_bus_unown_name(registration.id);
+    }
 }
 
-connection::~connection()
+void connection::connect()
+{
+    thread_default_context scope(m_context);
+
+    m_connect_started = g_get_monotonic_time();
+    g_bus_get(m_type, m_cancellable, on_dbus_connected, this);
+}
+
+void connection::on_bus_connected(gdbus::pointer<GDBusConnection> bus,
+                                  gdbus::pointer<GError> error) noexcept
 {
+    m_connect_finished = g_get_monotonic_time();
+    m_connection = std::move(bus);
+    m_connect_error = std::move(error);
+
+    if (!m_connection) {
+        m_attachments.clear();
+        fail(gdbus::error(GDBUS_CPP_ERROR_NAME,
+                          append_g_error("Couldn't create " + bus_type_to_string(m_type)
+                                             + " bus connection",
+                                         m_connect_error)));
+        return;
+    }
+
+    m_filter = g_dbus_connection_add_filter(m_connection, on_dbus_message_filter, this, nullptr);
+    m_credentials.attach(m_connection, m_context);
+
+    gdbus::debugger() << "DBus connection established"
+                      << "\n   - Bus:  '" << bus_type_to_string(m_type) << "'"
+                      << "\n   - Time: " << (m_connect_finished - m_connect_started) << "us";
+
+    std::vector<attachment> attachments = std::move(m_attachments);
+    m_attachments.clear();
+
+    for (auto &attachment: attachments) {
+        try {
+            activate(attachment);
+        }
+        catch (const gdbus::error &error) {
+            fail(error);
+        }
+    }
+}
+
+void connection::fail(gdbus::error error) noexcept
+{
+    if (!m_failure) {
+        m_failure = std::move(error);
+    }
+
     stop();
+}
 
-    for (const auto &object_registration: m_object_registrations) {
-        g_dbus_connection_unregister_object(m_connection, object_registration);
+void connection::rethrow_failure()
+{
+    if (m_failure) {
+        gdbus::error failure = std::move(*m_failure);
+        m_failure.reset();
+
+        throw failure;
+    }
+}
+
+void connection::enter_call(const char *sender,
+                            const char *object_path,
+                            const char *interface_name,
+                            const char *method_name) noexcept
+{
+    if (m_watchdog) {
+        m_watchdog->enter(sender, object_path, interface_name, method_name);
+    }
+}
+
+void connection::leave_call() noexcept
+{
+    if (m_watchdog) {
+        m_watchdog->leave();
+    }
+}
+
+void connection::watch_stalls(const gdbus::endpoint &owner,
+                              std::chrono::milliseconds threshold,
+                              std::function<void(const gdbus::stall_report &)> callback,
+                              bool capture_stack)
+{
+    claim(m_watchdog_owner, owner, "Stall watchdog");
+    m_watchdog = std::make_unique<gdbus::watchdog>(m_context,
+                                                   threshold,
+                                                   std::move(callback),
+                                                   capture_stack);
+}
+
+std::size_t connection::stalls(const gdbus::endpoint &owner) const noexcept
+{
+    return m_watchdog && m_watchdog_owner == &owner ? m_watchdog->stalls() : 0;
+}
+
+void connection::flush_trace_on_signal(const gdbus::endpoint &owner,
+                                       int signal,
+                                       const std::string &path)
+{
+    claim(m_tracing_owner, owner, "Trace flushing");
+    stop_tracing();
+
+    {
+        std::lock_guard<std::mutex> lock(tracing_mutex);
+
+        if (tracing_connections++ == 0) {
+            gdbus::tracer::enable();
+        }
+    }
+
+    m_trace_flush_source = g_unix_signal_source_new(signal);
+    g_source_set_callback(m_trace_flush_source,
+                          on_trace_flush_signal,
+                          new std::string(path),
+                          free_trace_path);
+    g_source_attach(m_trace_flush_source, m_context);
+}
+
+void connection::stop_tracing() noexcept
+{
+    if (!m_trace_flush_source) {
+        return;
+    }
+
+    g_source_destroy(m_trace_flush_source);
+    g_source_unref(m_trace_flush_source);
+    m_trace_flush_source = nullptr;
+
+    std::lock_guard<std::mutex> lock(tracing_mutex);
+
+    if (--tracing_connections == 0) {
+        gdbus::tracer::disable();
+    }
+}
+
+void connection::capture_to(const gdbus::endpoint &owner, const std::string &path)
+{
+    claim(m_recorder_owner, owner, "Call capture");
+    m_recorder = std::make_unique<gdbus::recorder>(path);
+    m_capturing = true;
+}
+
+gdbus::recorder *connection::recorder() noexcept
+{
+    return m_recorder.get();
+}
+
+bool connection::capturing() const noexcept
+{
+    return m_capturing.load(std::memory_order_relaxed);
+}
+
+gdbus::credentials_cache &connection::credentials() noexcept
+{
+    return m_credentials;
+}
+
+void connection::authorize(GDBusMethodInvocation *invocation,
+                           const gdbus::credentials *credentials) noexcept
+{
+    gdbus::span_fields fields = invocation_fields(invocation);
+    call_scope scope(this, fields.sender, fields.path, fields.interface, fields.member);
+    const char *policy = method_policy(g_dbus_method_invocation_get_method_info(invocation));
+    const auto &policies = call_owner(invocation).policies;
+    auto check = policies.find(policy);
+    bool allowed = false;
+
+    if (credentials && check != policies.end()) {
+        try {
+            allowed = check->second(*credentials);
+        }
+        catch (const std::exception &error) {
+            gdbus::debugger() << "Policy check failed"
+                              << "\n   - Policy: '" << policy << "'"
+                              << "\n   - Error:  '" << error.what() << "'";
+        }
     }
 
-    g_bus_unown_name(m_name_registration);
-    g_main_context_pop_thread_default(m_context);
+    if (!allowed) {
+        gdbus::debugger() << "Method call denied by policy"
+                          << "\n   - Sender: '" << fields.sender << "'"
+                          << "\n   - Method: '" << fields.member << "'"
+                          << "\n   - Policy: '" << policy << "'";
+
+        g_dbus_method_invocation_return_dbus_error(invocation,
+                                                   "org.freedesktop.DBus.Error.AccessDenied",
+                                                   "Access denied by policy");
+        return;
+    }
+
+    dispatch_method_call(this, invocation, fields);
+}
+
+void connection::hand_over(const std::shared_ptr<gdbus::endpoint> &endpoint)
+{
+    if (endpoint->drain_source) {
+        return;
+    }
+
+    gint64 now = g_get_monotonic_time();
+    auto *state = new drain_state{this,
+                                  endpoint,
+                                  now,
+                                  now + std::chrono::microseconds(endpoint->drain_timeout).count(),
+                                  endpoint->pending_calls};
+
+    endpoint->drain_source = g_timeout_source_new(5);
+    g_source_set_callback(endpoint->drain_source, on_drain_tick, state, free_drain_state);
+    g_source_attach(endpoint->drain_source, m_context);
+}
+
+void connection::finish_handover(const std::shared_ptr<gdbus::endpoint> &endpoint,
+                                 std::size_t calls,
+                                 std::chrono::microseconds drain) noexcept
+{
+    std::shared_ptr<gdbus::endpoint> owner = endpoint;
+    gdbus::handover_report report = {calls, owner->pending_calls, drain};
+
+    gdbus::debugger() << "Service handed over"
+                      << "\n   - Name:      '" << owner->name << "'"
+                      << "\n   - Calls:     " << report.calls
+                      << "\n   - Abandoned: " << report.abandoned
+                      << "\n   - Drain:     " << report.drain.count() << "us";
+
+    detach(*owner);
+
+    if (!has_names()) {
+        stop();
+    }
+
+    if (owner->on_handover) {
+        owner->on_handover(report);
+    }
+}
+
+void connection::detach(gdbus::endpoint &endpoint) noexcept
+{
+    m_attachments.erase(std::remove_if(m_attachments.begin(),
+                                       m_attachments.end(),
+                                       [&](const attachment &attachment) {
+                                           return attachment.endpoint.get() == &endpoint;
+                                       }),
+                        m_attachments.end());
+
+    if (endpoint.drain_source) {
+        g_source_destroy(endpoint.drain_source);
+        g_source_unref(endpoint.drain_source);
+        endpoint.drain_source = nullptr;
+    }
+
+    unregister_name(endpoint);
+    unregister_objects(endpoint);
+    release(endpoint);
+}
+
+void connection::claim(const gdbus::endpoint *&setting,
+                       const gdbus::endpoint &owner,
+                       const std::string &description) const
+{
+    if (setting && setting != &owner) {
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME,
+                           description + " of " + bus_type_to_string(m_type)
+                               + " bus connection is already configured by '" + setting->name
+                               + "' service");
+    }
+
+    setting = &owner;
+}
+
+void connection::release(const gdbus::endpoint &owner) noexcept
+{
+    if (m_watchdog_owner == &owner) {
+        m_watchdog.reset();
+        m_watchdog_owner = nullptr;
+    }
+
+    if (m_recorder_owner == &owner) {
+        m_capturing = false;
+        m_recorder.reset();
+        m_recorder_owner = nullptr;
+    }
+
+    if (m_tracing_owner == &owner) {
+        stop_tracing();
+        m_tracing_owner = nullptr;
+    }
 }
 
 GBusType connection::type() const noexcept
@@ -197,34 +879,235 @@ GBusType connection::type() const noexcept
     return m_type;
 }
 
-void connection::register_name(const std::string &name)
+
+void connection::register_name(const std::shared_ptr<gdbus::endpoint> &endpoint,
+                               GBusNameOwnerFlags flags,
+                               std::function<void()> on_acquired)
 {
-    guint name_registration = g_bus_own_name_on_connection(m_connection,
-                                                           name.c_str(),
-                                                           G_BUS_NAME_OWNER_FLAGS_NONE,
-                                                           on_dbus_name_acquired,
-                                                           on_dbus_name_lost,
-                                                           this,
-                                                           nullptr);
-    if (!name_registration) {
+    const std::string &name = endpoint->name;
+    auto [it, inserted] = m_names.try_emplace(name,
+                                              name_registration{this,
+                                                                0,
+                                                                flags,
+                                                                false,
+                                                                std::move(on_acquired),
+                                                                endpoint});
+
+    if (!inserted) {
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME,
+                           "Name '" + name + "' is already registered on "
+                               + bus_type_to_string(m_type) + " bus connection");
+    }
+
+    {
+        thread_default_context scope(m_context);
+
+        it->second.id = g_bus_own_name_on_connection(m_connection,
+                                                     name.c_str(),
+                                                     flags,
+                                                     on_dbus_name_acquired,
+                                                     on_dbus_name_lost,
+                                                     &it->second,
+                                                     nullptr);
+    }
+
+    if (!it->second.id) {
+        m_names.erase(it);
         throw gdbus::error(GDBUS_CPP_ERROR_NAME,
                            "Couldn't register name on " + bus_type_to_string(m_type)
                                + " bus connection");
     }
+}
 
-    m_name_registration = name_registration;
+void connection::unregister_name(const gdbus::endpoint &endpoint) noexcept
+{
+    auto it = m_names.find(endpoint.name);
+
+    if (it != m_names.end() && it->second.owner.lock().get() == &endpoint) {
+        g_bus_unown_name(it->second.id);
+        m_names.erase(it);
+    }
+}
+
+bool connection::has_names() const noexcept
+{
+    return !m_names.empty();
+}
+
+void connection::bind_to_current_thread()
+{
+    std::thread::id unbound;
+
+    if (!m_thread.compare_exchange_strong(unbound, std::this_thread::get_id())
+        && unbound != std::this_thread::get_id()) {
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME,
+                           "Services on shared " + bus_type_to_string(m_type)
+                               + " bus connection must be attached from one thread");
+    }
 }
 
-void connection::register_objects(const std::vector<gdbus::object> &objects)
+void connection::attach(const std::shared_ptr<gdbus::endpoint> &endpoint,
+                        const std::vector<gdbus::object> &objects,
+                        GBusNameOwnerFlags flags,
+                        std::function<void(const gdbus::startup_timings &)> on_ready)
 {
+    bool pending = std::any_of(m_attachments.begin(),
+                               m_attachments.end(),
+                               [&](const attachment &attachment) {
+                                   return attachment.endpoint->name == endpoint->name;
+                               });
+
+    if (pending || m_names.count(endpoint->name)) {
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME,
+                           "Name '" + endpoint->name + "' is already registered on "
+                               + bus_type_to_string(m_type) + " bus connection");
+    }
+
+    if (m_connect_error) {
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME,
+                           append_g_error("Couldn't create " + bus_type_to_string(m_type)
+                                              + " bus connection",
+                                          m_connect_error));
+    }
+
+    attachment attachment = {endpoint, {}, flags, std::move(on_ready), {}, g_get_monotonic_time()};
+
     for (const auto &object: objects) {
-        register_object(object);
+        for (const auto &interface: object.interfaces()) {
+            attachment.nodes.emplace_back(object.path(),
+                                          g_dbus_node_info_ref(introspect(*interface)));
+        }
+    }
+
+    attachment.timings.introspection = std::chrono::microseconds(g_get_monotonic_time()
+                                                                 - attachment.started);
+
+    if (m_connection) {
+        activate(attachment);
+        return;
     }
+
+    m_attachments.push_back(std::move(attachment));
+}
+
+void connection::activate(attachment &attachment)
+{
+    const std::shared_ptr<gdbus::endpoint> &endpoint = attachment.endpoint;
+    gdbus::startup_timings &timings = attachment.timings;
+
+    /* Services attached after the handshake share it and report no wait. */
+    timings.connect = std::chrono::microseconds(
+        std::max<gint64>(m_connect_finished - attachment.started, 0));
+
+    gint64 register_started = g_get_monotonic_time();
+
+    try {
+        thread_default_context scope(m_context);
+
+        for (auto &[path, node]: attachment.nodes) {
+            register_object_interface(endpoint, path, std::move(node));
+        }
+    }
+    catch (...) {
+        unregister_objects(*endpoint);
+        throw;
+    }
+
+    gint64 name_requested = g_get_monotonic_time();
+    timings.registration = std::chrono::microseconds(name_requested - register_started);
+
+    auto on_acquired = [name = endpoint->name,
+                        on_ready = std::move(attachment.on_ready),
+                        timings,
+                        started = attachment.started,
+                        name_requested]() mutable {
+        gint64 now = g_get_monotonic_time();
+
+        timings.name = std::chrono::microseconds(now - name_requested);
+        timings.total = std::chrono::microseconds(now - started);
+
+        gdbus::debugger() << "Service ready"
+                          << "\n   - Name:          '" << name << "'"
+                          << "\n   - Connect:       " << timings.connect.count() << "us"
+                          << "\n   - Introspection: " << timings.introspection.count() << "us"
+                          << "\n   - Registration:  " << timings.registration.count() << "us"
+                          << "\n   - Acquire:       " << timings.name.count() << "us"
+                          << "\n   - Total:         " << timings.total.count() << "us";
+
+        if (on_ready) {
+            on_ready(timings);
+        }
+    };
+
+    try {
+        register_name(endpoint, attachment.flags, std::move(on_acquired));
+    }
+    catch (...) {
+        unregister_objects(*endpoint);
+        throw;
+    }
+}
+
+void connection::unregister_objects(const gdbus::endpoint &endpoint) noexcept
+{
+    auto removed = std::remove_if(m_registrations.begin(),
+                                  m_registrations.end(),
+                                  [&](const registration &registration) {
+                                      if (registration.owner != &endpoint) {
+                                          return false;
+                                      }
+
+                                      g_dbus_connection_unregister_object(m_connection,
+                                                                          registration.id);
+                                      return true;
+                                  });
+
+    m_registrations.erase(removed, m_registrations.end());
+
+    for (auto it = m_introspection.begin(); it != m_introspection.end();) {
+        if (g_atomic_int_get(&it->second->ref_count) == 1) {
+            it = m_introspection.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+void connection::measure(const gdbus::endpoint &endpoint,
+                         gdbus::memory_report &report) const noexcept
+{
+    report.introspection = footprint::hash_map(m_introspection);
+
+    for (const auto &[introspection, node]: m_introspection) {
+        report.introspection += footprint::string(introspection) + node_info_size(node);
+    }
+
+    report.registrations = sizeof(registration)
+                           * std::count_if(m_registrations.begin(),
+                                           m_registrations.end(),
+                                           [&](const registration &registration) {
+                                               return registration.owner == &endpoint;
+                                           });
+    report.credentials = m_credentials.memory_usage();
 }
 
 void connection::start()
 {
+    if (m_running.exchange(true)) {
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME,
+                           "Main loop of " + bus_type_to_string(m_type)
+                               + " bus connection is already running");
+    }
+
     g_main_loop_run(m_mainloop);
+    m_running = false;
+
+    if (m_watchdog) {
+        m_watchdog->pause();
+    }
+
+    rethrow_failure();
 }
 
 void connection::stop()
@@ -234,44 +1117,116 @@ void connection::stop()
     }
 }
 
-void connection::register_object(const gdbus::object &object)
+bool connection::iterate(bool may_block)
 {
-    for (const auto &interface: object.interfaces()) {
-        register_object_interface(interface);
+    if (!g_main_context_acquire(m_context)) {
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME,
+                           "Main context of " + bus_type_to_string(m_type)
+                               + " bus connection is owned by another thread");
     }
+
+    bool dispatched = g_main_context_iteration(m_context, may_block);
+    g_main_context_release(m_context);
+    rethrow_failure();
+
+    return dispatched;
 }
 
-void connection::register_object_interface(const std::shared_ptr<gdbus::interface> &interface)
+int connection::prepare(std::vector<GPollFD> &fds)
 {
-    const std::string &introspection = interface->introspection();
+    if (!g_main_context_acquire(m_context)) {
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME,
+                           "Main context of " + bus_type_to_string(m_type)
+                               + " bus connection is owned by another thread");
+    }
 
-    gdbus::pointer<GError> error;
-    gdbus::pointer<GDBusNodeInfo> node = g_dbus_node_info_new_for_xml(introspection.c_str(), &error);
+    g_main_context_prepare(m_context, &m_max_priority);
+
+    gint timeout = -1;
+    gint count = 0;
+
+    do {
+        fds.resize(std::max<std::size_t>(fds.capacity(), std::size_t(count)));
+        count = g_main_context_query(m_context,
+                                     m_max_priority,
+                                     &timeout,
+                                     fds.data(),
+                                     static_cast<gint>(fds.size()));
+    }
+    while (std::size_t(count) > fds.size());
 
+    fds.resize(count);
+    return timeout;
+}
+
+bool connection::dispatch(std::vector<GPollFD> &fds)
+{
+    bool ready = g_main_context_check(m_context,
+                                      m_max_priority,
+                                      fds.data(),
+                                      static_cast<gint>(fds.size()));
+    if (ready) {
+        g_main_context_dispatch(m_context);
+    }
+
+    g_main_context_release(m_context);
+    rethrow_failure();
+
+    return ready;
+}
+
+gdbus::pointer<GDBusNodeInfo> connection::parse_introspection(const gdbus::interface &interface)
+{
+    gdbus::pointer<GError> error;
+    gdbus::pointer<GDBusNodeInfo> node = g_dbus_node_info_new_for_xml(interface.introspection().c_str(),
+                                                                      &error);
     if (!node) {
         throw gdbus::error(GDBUS_CPP_ERROR_NAME,
-                           append_g_error("Couldn't parse " + interface->name()
+                           append_g_error("Couldn't parse " + interface.name()
                                               + " interface introspection",
                                           error));
     }
 
+    if (!node->interfaces || !node->interfaces[0]) {
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME,
+                           "Introspection of " + interface.name() + " interface has no interfaces");
+    }
+
+    return node;
+}
+
+GDBusNodeInfo *connection::introspect(const gdbus::interface &interface)
+{
+    auto it = m_introspection.find(interface.introspection());
+
+    if (it == m_introspection.end()) {
+        it = m_introspection.emplace(interface.introspection(), parse_introspection(interface)).first;
+    }
+
+    return it->second;
+}
+
+void connection::register_object_interface(const std::shared_ptr<gdbus::endpoint> &endpoint,
+                                           const std::string &path,
+                                           gdbus::pointer<GDBusNodeInfo> node)
+{
+    gdbus::pointer<GError> error;
     guint id = g_dbus_connection_register_object(m_connection,
-                                                 interface->object()->path().c_str(),
+                                                 path.c_str(),
                                                  node->interfaces[0],
                                                  &vtable,
-                                                 interface.get(),
-                                                 nullptr,
+                                                 new std::shared_ptr<gdbus::endpoint>(endpoint),
+                                                 free_endpoint,
                                                  &error);
     if (!id) {
         throw gdbus::error(GDBUS_CPP_ERROR_NAME,
-                           append_g_error("Couldn't register object with path "
-                                              + interface->object()->path() + " on "
+                           append_g_error("Couldn't register object with path " + path
+                                              + " on "
                                               + bus_type_to_string(m_type) + " bus connection",
                                           error));
     }
 
-    m_object_registrations.push_back(id);
-    m_nodes.push_back(std::move(node));
+    m_registrations.push_back({endpoint.get(), id, std::move(node)});
 }
 
 } /* namespace gdbus */
@@ -6,48 +6,187 @@
 #ifndef GDBUS_CPP_CONNECTION_HPP
 #define GDBUS_CPP_CONNECTION_HPP
 
+#include "credentials.hpp"
+#include "error.hpp"
 #include "pointer.hpp"
+#include "recorder.hpp"
+#include "service.hpp"
+#include "watchdog.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
 #include <memory>
+#include <optional>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace gdbus {
 
-class object;
 class interface;
+class connection;
+
+/* State of one service on a shared connection. Object registrations, name
+ * callbacks and in-flight calls refer to it rather than to gdbus::service,
+ * which may be moved or destroyed while they are still around. */
+struct endpoint
+{
+    gdbus::connection *connection;
+    std::string name;
+    std::chrono::milliseconds drain_timeout;
+    std::function<void(const gdbus::handover_report &)> on_handover;
+    std::map<std::string, gdbus::policy> policies;
+    std::atomic<std::size_t> pending_calls;
+    GSource *drain_source;
+};
 
 class connection
 {
 public:
-    static connection for_bus_with_type(GBusType type);
+    struct name_registration
+    {
+        gdbus::connection *connection;
+        guint id;
+        GBusNameOwnerFlags flags;
+        bool acquired;
+        std::function<void()> on_acquired;
+        std::weak_ptr<gdbus::endpoint> owner;
+    };
+
+public:
+    static std::shared_ptr<connection> for_bus_with_type(GBusType type);
     ~connection();
 
+    connection(const connection &) = delete;
+    connection &operator=(const connection &) = delete;
+
     GBusType type() const noexcept;
 
-    void register_name(const std::string &name);
-    void register_objects(const std::vector<gdbus::object> &objects);
+    void on_bus_connected(gdbus::pointer<GDBusConnection> bus, gdbus::pointer<GError> error) noexcept;
+    void fail(gdbus::error error) noexcept;
+
+    void enter_call(const char *sender,
+                    const char *object_path,
+                    const char *interface_name,
+                    const char *method_name) noexcept;
+    void leave_call() noexcept;
+
+    void watch_stalls(const gdbus::endpoint &owner,
+                      std::chrono::milliseconds threshold,
+                      std::function<void(const gdbus::stall_report &)> callback,
+                      bool capture_stack);
+    std::size_t stalls(const gdbus::endpoint &owner) const noexcept;
+
+    void flush_trace_on_signal(const gdbus::endpoint &owner, int signal, const std::string &path);
+
+    void capture_to(const gdbus::endpoint &owner, const std::string &path);
+    gdbus::recorder *recorder() noexcept;
+    bool capturing() const noexcept;
+
+    gdbus::credentials_cache &credentials() noexcept;
+    void authorize(GDBusMethodInvocation *invocation,
+                   const gdbus::credentials *credentials) noexcept;
+
+    void hand_over(const std::shared_ptr<gdbus::endpoint> &endpoint);
+    void finish_handover(const std::shared_ptr<gdbus::endpoint> &endpoint,
+                         std::size_t calls,
+                         std::chrono::microseconds drain) noexcept;
+    void detach(gdbus::endpoint &endpoint) noexcept;
+
+    void register_name(const std::shared_ptr<gdbus::endpoint> &endpoint,
+                       GBusNameOwnerFlags flags,
+                       std::function<void()> on_acquired);
+    void unregister_name(const gdbus::endpoint &endpoint) noexcept;
+    bool has_names() const noexcept;
+
+    void bind_to_current_thread();
+    void attach(const std::shared_ptr<gdbus::endpoint> &endpoint,
+                const std::vector<gdbus::object> &objects,
+                GBusNameOwnerFlags flags,
+                std::function<void(const gdbus::startup_timings &)> on_ready);
+    void unregister_objects(const gdbus::endpoint &endpoint) noexcept;
+
+    void measure(const gdbus::endpoint &endpoint, gdbus::memory_report &report) const noexcept;
 
     void start();
     void stop();
 
+    bool iterate(bool may_block);
+    int prepare(std::vector<GPollFD> &fds);
+    bool dispatch(std::vector<GPollFD> &fds);
+
 private:
     connection(GBusType type,
-               gdbus::pointer<GDBusConnection> connection,
                gdbus::pointer<GMainContext> context,
-               gdbus::pointer<GMainLoop> mainloop) noexcept;
+               gdbus::pointer<GMainLoop> mainloop,
+               gdbus::pointer<GCancellable> cancellable) noexcept;
+
+    struct attachment;
+
+    void connect();
+    void activate(attachment &attachment);
+    void claim(const gdbus::endpoint *&setting,
+               const gdbus::endpoint &owner,
+               const std::string &description) const;
+    void release(const gdbus::endpoint &owner) noexcept;
+    void stop_tracing() noexcept;
+    void rethrow_failure();
+
+    static gdbus::pointer<GDBusNodeInfo> parse_introspection(const gdbus::interface &interface);
+    GDBusNodeInfo *introspect(const gdbus::interface &interface);
+    void register_object_interface(const std::shared_ptr<gdbus::endpoint> &endpoint,
+                                   const std::string &path,
+                                   gdbus::pointer<GDBusNodeInfo> node);
+
+private:
+    /* A service waiting for the bus connection before it registers. */
+    struct attachment
+    {
+        std::shared_ptr<gdbus::endpoint> endpoint;
+        std::vector<std::pair<std::string, gdbus::pointer<GDBusNodeInfo>>> nodes;
+        GBusNameOwnerFlags flags;
+        std::function<void(const gdbus::startup_timings &)> on_ready;
+        gdbus::startup_timings timings;
+        gint64 started;
+    };
 
-    void register_object(const gdbus::object &object);
-    void register_object_interface(const std::shared_ptr<gdbus::interface> &interface);
+    struct registration
+    {
+        const gdbus::endpoint *owner;
+        guint id;
+        gdbus::pointer<GDBusNodeInfo> node;
+    };
 
 private:
     GBusType m_type;
     gdbus::pointer<GDBusConnection> m_connection;
     gdbus::pointer<GMainContext> m_context;
     gdbus::pointer<GMainLoop> m_mainloop;
-    guint m_name_registration;
-    std::vector<guint> m_object_registrations;
-    std::vector<gdbus::pointer<GDBusNodeInfo>> m_nodes;
+    gdbus::pointer<GCancellable> m_cancellable;
+    gdbus::pointer<GError> m_connect_error;
+    gint64 m_connect_started;
+    gint64 m_connect_finished;
+    gint m_max_priority;
+    guint m_filter;
+    GSource *m_trace_flush_source;
+    std::map<std::string, name_registration> m_names;
+    std::vector<registration> m_registrations;
+    std::vector<attachment> m_attachments;
+    std::unordered_map<std::string, gdbus::pointer<GDBusNodeInfo>> m_introspection;
+    std::optional<gdbus::error> m_failure;
+    std::unique_ptr<gdbus::watchdog> m_watchdog;
+    std::unique_ptr<gdbus::recorder> m_recorder;
+    const gdbus::endpoint *m_watchdog_owner;
+    const gdbus::endpoint *m_recorder_owner;
+    std::atomic<bool> m_capturing;
+    const gdbus::endpoint *m_tracing_owner;
+    std::atomic<std::thread::id> m_thread;
+    std::atomic<bool> m_running;
+    gdbus::credentials_cache m_credentials;
 };
 
 } /* namespace gdbus */
@@ -0,0 +1,26 @@
+/**
+* SPDX-FileCopyrightText: Copyright 2024 Denis Glazkov <glazzk.off@mail.ru>
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include "connection_group.hpp"
+#include "connection.hpp"
+
+namespace gdbus {
+
+std::shared_ptr<connection> connection_group::connection_for(GBusType type)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::weak_ptr<gdbus::connection> &shared = m_connections[type];
+
+    if (std::shared_ptr<gdbus::connection> connection = shared.lock()) {
+        return connection;
+    }
+
+    std::shared_ptr<gdbus::connection> connection = gdbus::connection::for_bus_with_type(type);
+    shared = connection;
+
+    return connection;
+}
+
+} /* namespace gdbus */
@@ -0,0 +1,44 @@
+/**
+* SPDX-FileCopyrightText: Copyright 2024 Denis Glazkov <glazzk.off@mail.ru>
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef GDBUS_CPP_CONNECTION_GROUP_HPP
+#define GDBUS_CPP_CONNECTION_GROUP_HPP
+
+#include "common.hpp"
+
+#include <gio/gio.h>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace gdbus {
+
+class connection;
+class service;
+
+/* Services in one group share a bus connection, main context and main loop
+ * per bus type. Attach them all from one thread, then start() or embed any
+ * one of them to run the shared loop. Services outside a group get a
+ * connection of their own. */
+class GDBUS_CPP_EXPORT_CLASS(connection_group)
+{
+public:
+    connection_group() = default;
+
+    connection_group(const connection_group &) = delete;
+    connection_group &operator=(const connection_group &) = delete;
+
+private:
+    friend class gdbus::service;
+    std::shared_ptr<gdbus::connection> connection_for(GBusType type);
+
+private:
+    std::mutex m_mutex;
+    std::map<GBusType, std::weak_ptr<gdbus::connection>> m_connections;
+};
+
+} /* namespace gdbus */
+
+#endif /* GDBUS_CPP_CONNECTION_GROUP_HPP */
@@ -0,0 +1,238 @@
+/**
+* SPDX-FileCopyrightText: Copyright 2024 Denis Glazkov <glazzk.off@mail.ru>
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include "credentials.hpp"
+#include "common.hpp"
+#include "debugger.hpp"
+#include "footprint.hpp"
+
+#include <optional>
+
+namespace {
+
+struct credentials_request
+{
+    gdbus::credentials_cache *cache;
+    std::string sender;
+};
+
+std::string id_to_string(const std::optional<std::uint32_t> &id)
+{
+    return id ? std::to_string(*id) : "unknown";
+}
+
+std::optional<std::uint32_t> lookup_uint32(GVariant *dictionary, const char *key)
+{
+    gdbus::pointer<GVariant> value = g_variant_lookup_value(dictionary,
+                                                            key,
+                                                            G_VARIANT_TYPE_UINT32);
+    if (!value) {
+        return std::nullopt;
+    }
+
+    return g_variant_get_uint32(value);
+}
+
+void on_dbus_credentials(GObject *source, GAsyncResult *result, gpointer userdata)
+{
+    auto *request = static_cast<credentials_request *>(userdata);
+
+    gdbus::pointer<GError> error;
+    gdbus::pointer<GVariant> reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source),
+                                                                   result,
+                                                                   &error);
+
+    if (reply || !g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        request->cache->on_credentials(request->sender, reply);
+    }
+
+    delete request;
+}
+
+void on_dbus_name_owner_changed(GDBusConnection *,
+                                const char *,
+                                const char *,
+                                const char *,
+                                const char *,
+                                GVariant *parameters,
+                                gpointer userdata)
+{
+    const char *name = nullptr;
+    const char *old_owner = nullptr;
+    const char *new_owner = nullptr;
+
+    g_variant_get(parameters, "(&s&s&s)", &name, &old_owner, &new_owner);
+
+    if (name[0] == ':' && new_owner[0] == '\0') {
+        static_cast<gdbus::credentials_cache *>(userdata)->on_name_vanished(name);
+    }
+}
+
+} /* namespace */
+
+namespace gdbus {
+
+credentials_cache::credentials_cache(resolved_callback on_resolved)
+    : m_on_resolved(std::move(on_resolved))
+    , m_bus(nullptr)
+    , m_context(nullptr)
+    , m_subscription(0)
+    , m_cancellable(g_cancellable_new())
+{}
+
+credentials_cache::~credentials_cache()
+{
+    g_cancellable_cancel(m_cancellable);
+
+    if (m_subscription) {
+        g_dbus_connection_signal_unsubscribe(m_bus, m_subscription);
+    }
+
+    for (const auto &[sender, waiters]: m_waiters) {
+        for (GDBusMethodInvocation *waiter: waiters) {
+            g_dbus_method_invocation_return_dbus_error(waiter,
+                                                       GDBUS_CPP_ERROR_NAME,
+                                                       "Connection closed");
+        }
+    }
+}
+
+void credentials_cache::attach(GDBusConnection *bus, GMainContext *context)
+{
+    m_bus = bus;
+    m_context = context;
+}
+
+void credentials_cache::watch_names()
+{
+    if (m_subscription) {
+        return;
+    }
+
+    /* Subscribed on first use only, so services without policies don't
+     * receive every NameOwnerChanged broadcast on the bus. */
+    g_main_context_push_thread_default(m_context);
+    m_subscription = g_dbus_connection_signal_subscribe(m_bus,
+                                                        "org.freedesktop.DBus",
+                                                        "org.freedesktop.DBus",
+                                                        "NameOwnerChanged",
+                                                        "/org/freedesktop/DBus",
+                                                        nullptr,
+                                                        G_DBUS_SIGNAL_FLAGS_NONE,
+                                                        on_dbus_name_owner_changed,
+                                                        this,
+                                                        nullptr);
+    g_main_context_pop_thread_default(m_context);
+}
+
+void credentials_cache::resolve(GDBusMethodInvocation *invocation)
+{
+    const char *sender = g_dbus_method_invocation_get_sender(invocation);
+    auto cached = m_cache.find(sender ? sender : "");
+
+    if (cached != m_cache.end()) {
+        m_on_resolved(invocation, &cached->second);
+        return;
+    }
+
+    if (!sender || !m_bus) {
+        m_on_resolved(invocation, nullptr);
+        return;
+    }
+
+    auto [waiters, inserted] = m_waiters.try_emplace(sender);
+    waiters->second.push_back(invocation);
+
+    if (!inserted) {
+        return;
+    }
+
+    watch_names();
+
+    g_main_context_push_thread_default(m_context);
+    g_dbus_connection_call(m_bus,
+                           "org.freedesktop.DBus",
+                           "/org/freedesktop/DBus",
+                           "org.freedesktop.DBus",
+                           "GetConnectionCredentials",
+                           g_variant_new("(s)", sender),
+                           G_VARIANT_TYPE("(a{sv})"),
+                           G_DBUS_CALL_FLAGS_NONE,
+                           -1,
+                           m_cancellable,
+                           on_dbus_credentials,
+                           new credentials_request{this, sender});
+    g_main_context_pop_thread_default(m_context);
+}
+
+void credentials_cache::on_credentials(const std::string &sender, GVariant *reply) noexcept
+{
+    auto node = m_waiters.extract(sender);
+    bool vanished = m_vanished.erase(sender) > 0;
+    gdbus::credentials credentials = {};
+    const gdbus::credentials *resolved = nullptr;
+
+    if (reply) {
+        gdbus::pointer<GVariant> dictionary = g_variant_get_child_value(reply, 0);
+        credentials = {lookup_uint32(dictionary, "UnixUserID"),
+                       lookup_uint32(dictionary, "ProcessID")};
+        resolved = &credentials;
+    }
+
+    /* A sender that disconnected while the lookup was in flight would never
+     * be evicted again, so its credentials only answer the waiting calls. */
+    if (resolved && !vanished) {
+        resolved = &m_cache.insert_or_assign(sender, credentials).first->second;
+
+        gdbus::debugger() << "Sender credentials cached"
+                          << "\n   - Sender: '" << sender << "'"
+                          << "\n   - UID:    " << id_to_string(credentials.uid)
+                          << "\n   - PID:    " << id_to_string(credentials.pid);
+    }
+
+    if (node.empty()) {
+        return;
+    }
+
+    for (GDBusMethodInvocation *waiter: node.mapped()) {
+        m_on_resolved(waiter, resolved);
+    }
+}
+
+void credentials_cache::on_name_vanished(const std::string &name) noexcept
+{
+    m_cache.erase(name);
+
+    if (m_waiters.count(name)) {
+        m_vanished.insert(name);
+    }
+}
+
+std::size_t credentials_cache::size() const noexcept
+{
+    return m_cache.size();
+}
+
+std::size_t credentials_cache::memory_usage() const noexcept
+{
+    std::size_t usage = footprint::hash_map(m_cache) + footprint::hash_map(m_waiters)
+                        + footprint::hash_map(m_vanished);
+
+    for (const auto &[sender, credentials]: m_cache) {
+        usage += footprint::string(sender);
+    }
+
+    for (const auto &[sender, waiters]: m_waiters) {
+        usage += footprint::string(sender) + footprint::vector(waiters);
+    }
+
+    for (const auto &sender: m_vanished) {
+        usage += footprint::string(sender);
+    }
+
+    return usage;
+}
+
+} /* namespace gdbus */
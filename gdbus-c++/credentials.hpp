@@ -0,0 +1,57 @@
+/**
+* SPDX-FileCopyrightText: Copyright 2024 Denis Glazkov <glazzk.off@mail.ru>
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef GDBUS_CPP_CREDENTIALS_HPP
+#define GDBUS_CPP_CREDENTIALS_HPP
+
+#include "pointer.hpp"
+#include "service.hpp"
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace gdbus {
+
+class credentials_cache
+{
+public:
+    using resolved_callback =
+        std::function<void(GDBusMethodInvocation *, const gdbus::credentials *)>;
+
+    explicit credentials_cache(resolved_callback on_resolved);
+    ~credentials_cache();
+
+    credentials_cache(const credentials_cache &) = delete;
+    credentials_cache &operator=(const credentials_cache &) = delete;
+
+    void attach(GDBusConnection *bus, GMainContext *context);
+    void resolve(GDBusMethodInvocation *invocation);
+
+    void on_credentials(const std::string &sender, GVariant *reply) noexcept;
+    void on_name_vanished(const std::string &name) noexcept;
+
+    std::size_t size() const noexcept;
+    std::size_t memory_usage() const noexcept;
+
+private:
+    void watch_names();
+
+private:
+    resolved_callback m_on_resolved;
+    GDBusConnection *m_bus;
+    GMainContext *m_context;
+    guint m_subscription;
+    gdbus::pointer<GCancellable> m_cancellable;
+    std::unordered_map<std::string, gdbus::credentials> m_cache;
+    std::unordered_map<std::string, std::vector<GDBusMethodInvocation *>> m_waiters;
+    std::unordered_set<std::string> m_vanished;
+};
+
+} /* namespace gdbus */
+
+#endif /* GDBUS_CPP_CREDENTIALS_HPP */
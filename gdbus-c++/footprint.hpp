@@ -0,0 +1,46 @@
+/**
+* SPDX-FileCopyrightText: Copyright 2024 Denis Glazkov <glazzk.off@mail.ru>
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef GDBUS_CPP_FOOTPRINT_HPP
+#define GDBUS_CPP_FOOTPRINT_HPP
+
+#include <cstddef>
+#include <string>
+
+namespace gdbus::footprint {
+
+/* Estimates of heap bytes owned by standard containers, used by
+ * service::memory_report(). Node overhead assumes the libstdc++ layout: a
+ * next pointer and a cached hash per element. */
+
+template<typename CharT, typename Traits, typename Allocator>
+std::size_t string(const std::basic_string<CharT, Traits, Allocator> &value) noexcept
+{
+    const auto *data = reinterpret_cast<const char *>(value.data());
+    const auto *begin = reinterpret_cast<const char *>(&value);
+
+    if (data >= begin && data < begin + sizeof(value)) {
+        return 0;
+    }
+
+    return (value.capacity() + 1) * sizeof(CharT);
+}
+
+template<typename Vector>
+std::size_t vector(const Vector &value) noexcept
+{
+    return value.capacity() * sizeof(typename Vector::value_type);
+}
+
+template<typename Map>
+std::size_t hash_map(const Map &value) noexcept
+{
+    return value.bucket_count() * sizeof(void *)
+           + value.size() * (sizeof(typename Map::value_type) + 2 * sizeof(void *));
+}
+
+} /* namespace gdbus::footprint */
+
+#endif /* GDBUS_CPP_FOOTPRINT_HPP */
@@ -6,9 +6,13 @@
 #ifndef GDBUS_CPP_GDBUS_CPP_HPP
 #define GDBUS_CPP_GDBUS_CPP_HPP
 
+#include "connection_group.hpp"
 #include "error.hpp"
 #include "interface.hpp"
 #include "object.hpp"
 #include "service.hpp"
+#include "stream.hpp"
+#include "subscriptions.hpp"
+#include "tracer.hpp"
 
 #endif /* GDBUS_CPP_GDBUS_CPP_HPP */
@@ -39,7 +39,7 @@ private:
 template<typename Interface>
 std::shared_ptr<gdbus::interface> make_interface()
 {
-    return std::shared_ptr<gdbus::interface>(new Interface());
+    return std::make_shared<Interface>();
 }
 
 } /* namespace gdbus */
@@ -7,6 +7,7 @@
 #define GDBUS_CPP_POINTER_HPP
 
 #include <gio/gio.h>
+#include <gio/gunixfdlist.h>
 #include <utility>
 
 namespace gdbus {
@@ -33,6 +34,15 @@ struct pointer_cleanuper<GDBusConnection>
     }
 };
 
+template<>
+struct pointer_cleanuper<GCancellable>
+{
+    static void cleanup(GCancellable *cancellable) noexcept
+    {
+        g_object_unref(cancellable);
+    }
+};
+
 template<>
 struct pointer_cleanuper<GMainContext>
 {
@@ -87,6 +97,24 @@ struct pointer_cleanuper<GVariantBuilder>
     }
 };
 
+template<>
+struct pointer_cleanuper<GBytes>
+{
+    static void cleanup(GBytes *bytes) noexcept
+    {
+        g_bytes_unref(bytes);
+    }
+};
+
+template<>
+struct pointer_cleanuper<GUnixFDList>
+{
+    static void cleanup(GUnixFDList *fd_list) noexcept
+    {
+        g_object_unref(fd_list);
+    }
+};
+
 template<typename T>
 struct pointer
 {
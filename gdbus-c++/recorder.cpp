@@ -0,0 +1,176 @@
+/**
+* SPDX-FileCopyrightText: Copyright 2024 Denis Glazkov <glazzk.off@mail.ru>
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include "recorder.hpp"
+#include "common.hpp"
+#include "debugger.hpp"
+#include "error.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+namespace {
+
+std::uint16_t field_size(const char *field) noexcept
+{
+    return field ? static_cast<std::uint16_t>(std::min<std::size_t>(strlen(field), UINT16_MAX)) : 0;
+}
+
+void append(std::vector<char> &buffer, const void *data, std::size_t size)
+{
+    if (size > 0) {
+        std::size_t offset = buffer.size();
+        buffer.resize(offset + size);
+        memcpy(buffer.data() + offset, data, size);
+    }
+}
+
+} /* namespace */
+
+namespace gdbus {
+
+recorder::recorder(const std::string &path)
+    : m_path(path)
+    , m_file(fopen(path.c_str(), "wb"))
+    , m_started(g_get_monotonic_time())
+    , m_stopping(false)
+    , m_dropping(false)
+    , m_failed(false)
+{
+    if (!m_file) {
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME, "Couldn't open capture file " + path);
+    }
+
+    if (!write(capture_format::magic, sizeof(capture_format::magic))
+        || !write(&capture_format::version, sizeof(capture_format::version))
+        || fflush(m_file) != 0) {
+        fclose(m_file);
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME, "Couldn't write capture file " + path);
+    }
+
+    try {
+        m_writer = std::thread(&recorder::run, this);
+    }
+    catch (const std::system_error &) {
+        fclose(m_file);
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME, "Couldn't start capture writer for " + path);
+    }
+}
+
+recorder::~recorder()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+
+    m_wakeup.notify_one();
+    m_writer.join();
+    fclose(m_file);
+}
+
+void recorder::record(GDBusMethodInvocation *invocation, GVariant *arguments, gint64 received) noexcept
+{
+    if (m_failed.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    GDBusMessage *message = g_dbus_method_invocation_get_message(invocation);
+
+    const char *sender = g_dbus_message_get_sender(message);
+    const char *destination = g_dbus_message_get_destination(message);
+    const char *path = g_dbus_message_get_path(message);
+    const char *interface = g_dbus_message_get_interface(message);
+    const char *member = g_dbus_message_get_member(message);
+    const char *signature = g_variant_get_type_string(arguments);
+    const void *body = g_variant_get_data(arguments);
+
+    capture_format::record record = {};
+    record.timestamp_us = static_cast<std::uint64_t>(std::max<gint64>(received - m_started, 0));
+    record.sender_size = field_size(sender);
+    record.destination_size = field_size(destination);
+    record.path_size = field_size(path);
+    record.interface_size = field_size(interface);
+    record.member_size = field_size(member);
+    record.signature_size = field_size(signature);
+    record.body_size = body ? static_cast<std::uint32_t>(g_variant_get_size(arguments)) : 0;
+
+    std::size_t size = sizeof(record) + record.sender_size + record.destination_size
+                       + record.path_size + record.interface_size + record.member_size
+                       + record.signature_size + record.body_size;
+    bool wake = false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (m_pending.size() + size > max_pending) {
+            if (!m_dropping) {
+                m_dropping = true;
+                gdbus::debugger() << "Capture to '" << m_path << "' can't keep up, dropping calls";
+            }
+
+            return;
+        }
+
+        m_dropping = false;
+
+        append(m_pending, &record, sizeof(record));
+        append(m_pending, sender, record.sender_size);
+        append(m_pending, destination, record.destination_size);
+        append(m_pending, path, record.path_size);
+        append(m_pending, interface, record.interface_size);
+        append(m_pending, member, record.member_size);
+        append(m_pending, signature, record.signature_size);
+        append(m_pending, body, record.body_size);
+
+        wake = m_pending.size() >= flush_size;
+    }
+
+    if (wake) {
+        m_wakeup.notify_one();
+    }
+}
+
+bool recorder::write(const void *data, std::size_t size) noexcept
+{
+    return size == 0 || fwrite(data, 1, size, m_file) == size;
+}
+
+void recorder::run() noexcept
+{
+    std::vector<char> batch;
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true) {
+        m_wakeup.wait_for(lock, flush_interval, [this]() {
+            return m_stopping || m_pending.size() >= flush_size;
+        });
+
+        bool stopping = m_stopping;
+        batch.swap(m_pending);
+        lock.unlock();
+
+        /* Flushed every batch, so a daemon that is killed keeps all but the
+         * last flush_interval of its capture. */
+        if (!batch.empty() && (!write(batch.data(), batch.size()) || fflush(m_file) != 0)) {
+            m_failed = true;
+            gdbus::debugger() << "Couldn't write capture file '" << m_path
+                              << "': " << g_strerror(errno) << ", capture stopped";
+            return;
+        }
+
+        batch.clear();
+
+        if (stopping) {
+            return;
+        }
+
+        lock.lock();
+    }
+}
+
+} /* namespace gdbus */
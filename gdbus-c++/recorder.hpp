@@ -0,0 +1,91 @@
+/**
+* SPDX-FileCopyrightText: Copyright 2024 Denis Glazkov <glazzk.off@mail.ru>
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef GDBUS_CPP_RECORDER_HPP
+#define GDBUS_CPP_RECORDER_HPP
+
+#include <gio/gio.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace gdbus {
+
+/* Capture file layout, all integers in host byte order:
+ *
+ *   header: magic[8] = "GDBUSCAP", uint32 version
+ *   record: capture_record, followed by the sender, destination, path,
+ *           interface, member and signature strings (without terminators)
+ *           and the serialized arguments
+ *
+ * timestamp_us is when the GDBus worker received the call, relative to the
+ * start of the capture, so time spent queued for dispatch isn't replayed as
+ * spacing between arrivals. */
+namespace capture_format {
+
+constexpr char magic[8] = {'G', 'D', 'B', 'U', 'S', 'C', 'A', 'P'};
+constexpr std::uint32_t version = 1;
+
+struct record
+{
+    std::uint64_t timestamp_us;
+    std::uint16_t sender_size;
+    std::uint16_t destination_size;
+    std::uint16_t path_size;
+    std::uint16_t interface_size;
+    std::uint16_t member_size;
+    std::uint16_t signature_size;
+    std::uint32_t body_size;
+};
+
+static_assert(sizeof(record) == 24, "capture record must not contain padding");
+
+} /* namespace capture_format */
+
+/* Records are buffered on the dispatching thread and written by a writer
+ * thread every flush_interval, or sooner once flush_size bytes are queued.
+ * Calls are dropped while max_pending bytes wait for a slow disk. */
+class recorder
+{
+public:
+    static constexpr std::chrono::milliseconds flush_interval{100};
+    static constexpr std::size_t flush_size = 64 * 1024;
+    static constexpr std::size_t max_pending = 16 * 1024 * 1024;
+
+    explicit recorder(const std::string &path);
+    ~recorder();
+
+    recorder(const recorder &) = delete;
+    recorder &operator=(const recorder &) = delete;
+
+    void record(GDBusMethodInvocation *invocation, GVariant *arguments, gint64 received) noexcept;
+
+private:
+    bool write(const void *data, std::size_t size) noexcept;
+    void run() noexcept;
+
+private:
+    std::string m_path;
+    std::FILE *m_file;
+    gint64 m_started;
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::vector<char> m_pending;
+    bool m_stopping;
+    bool m_dropping;
+    std::atomic<bool> m_failed;
+    std::thread m_writer;
+};
+
+} /* namespace gdbus */
+
+#endif /* GDBUS_CPP_RECORDER_HPP */
@@ -5,14 +5,88 @@
 
 #include "service.hpp"
 #include "connection.hpp"
+#include "connection_group.hpp"
+#include "debugger.hpp"
+#include "error.hpp"
+#include "footprint.hpp"
+#include "interface.hpp"
+#include "tracer.hpp"
+
+#include <unordered_set>
 
 namespace gdbus {
 
 service::service(std::string name) noexcept
     : m_name(std::move(name))
     , m_bus_type(G_BUS_TYPE_NONE)
+    , m_group(nullptr)
+    , m_name_flags(G_BUS_NAME_OWNER_FLAGS_NONE)
+    , m_drain_timeout(0)
+    , m_stall_threshold(0)
+    , m_capture_stall_stack(false)
+    , m_trace_signal(0)
 {}
 
+service::~service()
+{
+    detach();
+}
+
+service::service(service &&other) noexcept
+    : m_name(std::move(other.m_name))
+    , m_objects(std::move(other.m_objects))
+    , m_bus_type(other.m_bus_type)
+    , m_group(other.m_group)
+    , m_on_ready(std::move(other.m_on_ready))
+    , m_name_flags(other.m_name_flags)
+    , m_drain_timeout(other.m_drain_timeout)
+    , m_on_handover(std::move(other.m_on_handover))
+    , m_stall_threshold(other.m_stall_threshold)
+    , m_on_stall(std::move(other.m_on_stall))
+    , m_capture_stall_stack(other.m_capture_stall_stack)
+    , m_trace_path(std::move(other.m_trace_path))
+    , m_trace_signal(other.m_trace_signal)
+    , m_capture_path(std::move(other.m_capture_path))
+    , m_policies(std::move(other.m_policies))
+    , m_connection(std::move(other.m_connection))
+    , m_endpoint(std::move(other.m_endpoint))
+{
+    for (auto &object: m_objects) {
+        object.attach_to_service(this);
+    }
+}
+
+service &service::operator=(service &&other) noexcept
+{
+    if (this != std::addressof(other)) {
+        detach();
+
+        m_name = std::move(other.m_name);
+        m_objects = std::move(other.m_objects);
+        m_bus_type = other.m_bus_type;
+        m_group = other.m_group;
+        m_on_ready = std::move(other.m_on_ready);
+        m_name_flags = other.m_name_flags;
+        m_drain_timeout = other.m_drain_timeout;
+        m_on_handover = std::move(other.m_on_handover);
+        m_stall_threshold = other.m_stall_threshold;
+        m_on_stall = std::move(other.m_on_stall);
+        m_capture_stall_stack = other.m_capture_stall_stack;
+        m_trace_path = std::move(other.m_trace_path);
+        m_trace_signal = other.m_trace_signal;
+        m_capture_path = std::move(other.m_capture_path);
+        m_policies = std::move(other.m_policies);
+        m_connection = std::move(other.m_connection);
+        m_endpoint = std::move(other.m_endpoint);
+
+        for (auto &object: m_objects) {
+            object.attach_to_service(this);
+        }
+    }
+
+    return *this;
+}
+
 const std::string &service::name() const noexcept
 {
     return m_name;
@@ -35,6 +109,12 @@ service &service::on_system_bus() noexcept
     return *this;
 }
 
+service &service::in_group(gdbus::connection_group &group) noexcept
+{
+    m_group = &group;
+    return *this;
+}
+
 service &service::with_objects(std::vector<gdbus::object> &&objects) noexcept
 {
     m_objects = std::move(objects);
@@ -46,13 +126,202 @@ service &service::with_objects(std::vector<gdbus::object> &&objects) noexcept
     return *this;
 }
 
+service &service::on_ready(std::function<void(const gdbus::startup_timings &)> callback) noexcept
+{
+    m_on_ready = std::move(callback);
+    return *this;
+}
+
+service &service::allow_replacement(std::chrono::milliseconds drain_timeout) noexcept
+{
+    m_name_flags = GBusNameOwnerFlags(m_name_flags | G_BUS_NAME_OWNER_FLAGS_ALLOW_REPLACEMENT);
+    m_drain_timeout = drain_timeout;
+    return *this;
+}
+
+service &service::replace_existing() noexcept
+{
+    m_name_flags = GBusNameOwnerFlags(m_name_flags | G_BUS_NAME_OWNER_FLAGS_REPLACE);
+    return *this;
+}
+
+service &service::on_handover(std::function<void(const gdbus::handover_report &)> callback) noexcept
+{
+    m_on_handover = std::move(callback);
+    return *this;
+}
+
+service &service::with_stall_watchdog(std::chrono::milliseconds threshold,
+                                      std::function<void(const gdbus::stall_report &)> callback,
+                                      bool capture_stack) noexcept
+{
+    m_stall_threshold = threshold;
+    m_on_stall = std::move(callback);
+    m_capture_stall_stack = capture_stack;
+    return *this;
+}
+
+std::size_t service::stall_count() const
+{
+    return attached_connection().stalls(*m_endpoint);
+}
+
+service &service::with_tracing(std::string path, int flush_signal)
+{
+    switch (flush_signal) {
+    case SIGHUP:
+    case SIGINT:
+    case SIGTERM:
+    case SIGUSR1:
+    case SIGUSR2:
+    case SIGWINCH:
+        break;
+    default:
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME,
+                           "Signal " + std::to_string(flush_signal)
+                               + " can't be used to flush the trace of '" + m_name + "' service");
+    }
+
+    m_trace_path = std::move(path);
+    m_trace_signal = flush_signal;
+    return *this;
+}
+
+service &service::with_capture(std::string path) noexcept
+{
+    m_capture_path = std::move(path);
+    return *this;
+}
+
+service &service::with_policy(std::string name, gdbus::policy check) noexcept
+{
+    m_policies.insert_or_assign(std::move(name), std::move(check));
+    return *this;
+}
+
+gdbus::memory_report service::memory_report() const
+{
+    gdbus::memory_report report = {};
+    std::unordered_set<const gdbus::interface *> interfaces;
+
+    report.objects = footprint::vector(m_objects);
+
+    for (const auto &object: m_objects) {
+        report.objects += footprint::string(object.path()) + footprint::vector(object.interfaces());
+
+        for (const auto &interface: object.interfaces()) {
+            if (interfaces.insert(interface.get()).second) {
+                report.interfaces += sizeof(gdbus::interface) + footprint::string(interface->name())
+                                     + footprint::string(interface->introspection());
+            }
+        }
+    }
+
+    if (m_connection) {
+        m_connection->measure(*m_endpoint, report);
+    }
+
+    report.total = report.objects + report.interfaces + report.registrations;
+    report.tracing = gdbus::tracer::memory_usage();
+
+    return report;
+}
+
 void service::start()
 {
-    gdbus::connection connection = gdbus::connection::for_bus_with_type(m_bus_type);
+    attach();
+    m_connection->start();
+}
+
+void service::attach()
+{
+    if (m_connection) {
+        return;
+    }
+
+    std::shared_ptr<gdbus::connection> connection;
+
+    if (m_group) {
+        connection = m_group->connection_for(m_bus_type);
+    }
+    else {
+        connection = gdbus::connection::for_bus_with_type(m_bus_type);
+    }
+
+    connection->bind_to_current_thread();
+
+    auto endpoint = std::make_shared<gdbus::endpoint>();
+    endpoint->connection = connection.get();
+    endpoint->name = m_name;
+    endpoint->drain_timeout = m_drain_timeout;
+    endpoint->on_handover = m_on_handover;
+    endpoint->policies = m_policies;
+    endpoint->pending_calls = 0;
+    endpoint->drain_source = nullptr;
+
+    /* Without standby or replacement a second instance must not sit in the
+     * queue unnoticed, so a taken name fails the service instead. */
+    GBusNameOwnerFlags flags = m_name_flags;
+
+    if (!(flags & (G_BUS_NAME_OWNER_FLAGS_ALLOW_REPLACEMENT | G_BUS_NAME_OWNER_FLAGS_REPLACE))) {
+        flags = GBusNameOwnerFlags(flags | G_BUS_NAME_OWNER_FLAGS_DO_NOT_QUEUE);
+    }
+
+    try {
+        if (m_stall_threshold.count() > 0) {
+            connection->watch_stalls(*endpoint, m_stall_threshold, m_on_stall, m_capture_stall_stack);
+        }
+
+        if (!m_trace_path.empty()) {
+            connection->flush_trace_on_signal(*endpoint, m_trace_signal, m_trace_path);
+        }
+
+        if (!m_capture_path.empty()) {
+            connection->capture_to(*endpoint, m_capture_path);
+        }
+
+        connection->attach(endpoint, m_objects, flags, m_on_ready);
+    }
+    catch (...) {
+        connection->detach(*endpoint);
+        throw;
+    }
+
+    m_connection = std::move(connection);
+    m_endpoint = std::move(endpoint);
+}
+
+void service::detach() noexcept
+{
+    if (m_connection) {
+        m_connection->detach(*m_endpoint);
+        m_endpoint.reset();
+        m_connection.reset();
+    }
+}
+
+int service::prepare(std::vector<GPollFD> &fds)
+{
+    return attached_connection().prepare(fds);
+}
+
+bool service::dispatch_ready(std::vector<GPollFD> &fds)
+{
+    return attached_connection().dispatch(fds);
+}
+
+bool service::iterate(bool may_block)
+{
+    return attached_connection().iterate(may_block);
+}
+
+gdbus::connection &service::attached_connection() const
+{
+    if (!m_connection) {
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME, "Service '" + m_name + "' is not attached to a bus");
+    }
 
-    connection.register_name(m_name);
-    connection.register_objects(m_objects);
-    connection.start();
+    return *m_connection;
 }
 
 } /* namespace gdbus */
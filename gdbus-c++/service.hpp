@@ -9,32 +9,156 @@
 #include "common.hpp"
 #include "object.hpp"
 
+#include <chrono>
+#include <csignal>
+#include <functional>
 #include <gio/gio.h>
+#include <map>
+#include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
 namespace gdbus {
 
+class connection;
+class connection_group;
+struct endpoint;
+
+struct startup_timings
+{
+    std::chrono::microseconds connect;
+    std::chrono::microseconds introspection;
+    std::chrono::microseconds registration;
+    std::chrono::microseconds name;
+    std::chrono::microseconds total;
+};
+
+struct stall_report
+{
+    std::string sender;
+    std::string object;
+    std::string interface;
+    std::string method;
+    std::chrono::milliseconds stalled;
+    std::size_t count;
+    std::vector<std::string> stack;
+};
+
+struct handover_report
+{
+    std::size_t calls;
+    std::size_t abandoned;
+    std::chrono::microseconds drain;
+};
+
+struct credentials
+{
+    std::optional<std::uint32_t> uid;
+    std::optional<std::uint32_t> pid;
+};
+
+using policy = std::function<bool(const gdbus::credentials &)>;
+
+/* Estimated heap bytes per subsystem. objects, interfaces and registrations
+ * belong to the service and make up total. introspection and credentials
+ * are held by its connection, which every service of a connection_group
+ * shares, and tracing is process-wide, so count those once when adding up
+ * reports of several services. Introspection data is shared by all objects
+ * exposing identical XML, so it grows with distinct interfaces rather than
+ * with objects. */
+struct memory_report
+{
+    std::size_t objects;
+    std::size_t interfaces;
+    std::size_t registrations;
+    std::size_t total;
+
+    std::size_t introspection;
+    std::size_t credentials;
+    std::size_t tracing;
+};
+
 class GDBUS_CPP_EXPORT_CLASS(service)
 {
 public:
     explicit service(std::string name) noexcept;
+    ~service();
+
+    service(service &&) noexcept;
+    service &operator=(service &&) noexcept;
 
     const std::string &name() const noexcept;
 
     service &on_system_bus() noexcept;
     service &on_session_bus() noexcept;
+    service &in_group(gdbus::connection_group &group) noexcept;
     service &with_objects(std::vector<gdbus::object> &&objects) noexcept;
+    service &on_ready(std::function<void(const gdbus::startup_timings &)> callback) noexcept;
+
+    service &allow_replacement(
+        std::chrono::milliseconds drain_timeout = std::chrono::seconds(5)) noexcept;
+    service &replace_existing() noexcept;
+    service &on_handover(std::function<void(const gdbus::handover_report &)> callback) noexcept;
+
+    /* The stall watchdog, trace flushing and call capture act on the main
+     * loop shared by all services of a connection group on a bus, so only
+     * one of them may enable each; attach() throws for the others.
+     *
+     * capture_stack signals the loop thread with SIGRTMIN + 3, or with
+     * GDBUS_CPP_STACK_CAPTURE_SIGNAL if the library was built with it;
+     * attach() throws if the application already handles that signal. */
+    service &with_stall_watchdog(std::chrono::milliseconds threshold,
+                                 std::function<void(const gdbus::stall_report &)> callback,
+                                 bool capture_stack = false) noexcept;
+    std::size_t stall_count() const;
+
+    /* flush_signal must be one of SIGHUP, SIGINT, SIGTERM, SIGUSR1, SIGUSR2
+     * or SIGWINCH, the signals GLib can watch from a main loop. The tracer
+     * stays enabled until the last service with tracing detaches. */
+    service &with_tracing(std::string path, int flush_signal = SIGUSR1);
+    service &with_capture(std::string path) noexcept;
+    service &with_policy(std::string name, gdbus::policy check) noexcept;
+
+    gdbus::memory_report memory_report() const;
 
     void start();
 
+    /* Returns without waiting for the bus: objects and the name are
+     * registered from the main loop once connected, and on_ready() reports
+     * completion. Later failures are thrown from start() or the loop calls. */
+    void attach();
+
+    /* Embedding into an external reactor: poll the fds returned by prepare()
+     * for at most the returned timeout, store revents and pass them back to
+     * dispatch_ready(). Every prepare() must be followed by dispatch_ready(). */
+    int prepare(std::vector<GPollFD> &fds);
+    bool dispatch_ready(std::vector<GPollFD> &fds);
+    bool iterate(bool may_block);
+
 private:
     const std::vector<gdbus::object> &objects() const noexcept;
+    gdbus::connection &attached_connection() const;
+    void detach() noexcept;
 
 private:
     std::string m_name;
     std::vector<gdbus::object> m_objects;
     GBusType m_bus_type;
+    gdbus::connection_group *m_group;
+    std::function<void(const gdbus::startup_timings &)> m_on_ready;
+    GBusNameOwnerFlags m_name_flags;
+    std::chrono::milliseconds m_drain_timeout;
+    std::function<void(const gdbus::handover_report &)> m_on_handover;
+    std::chrono::milliseconds m_stall_threshold;
+    std::function<void(const gdbus::stall_report &)> m_on_stall;
+    bool m_capture_stall_stack;
+    std::string m_trace_path;
+    int m_trace_signal;
+    std::string m_capture_path;
+    std::map<std::string, gdbus::policy> m_policies;
+    std::shared_ptr<gdbus::connection> m_connection;
+    std::shared_ptr<gdbus::endpoint> m_endpoint;
 };
 
 } /* namespace gdbus */
@@ -0,0 +1,51 @@
+/**
+* SPDX-FileCopyrightText: Copyright 2024 Denis Glazkov <glazzk.off@mail.ru>
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef GDBUS_CPP_SPAN_HPP
+#define GDBUS_CPP_SPAN_HPP
+
+#include <gio/gio.h>
+
+namespace gdbus {
+
+struct span_fields
+{
+    const char *sender;
+    const char *path;
+    const char *interface;
+    const char *member;
+    guint32 serial;
+};
+
+class span
+{
+public:
+    span(const char *stage, const gdbus::span_fields &fields) noexcept;
+    ~span();
+
+    span(const span &) = delete;
+    span &operator=(const span &) = delete;
+
+    static int current_thread() noexcept;
+
+    static void instant(const char *stage, const gdbus::span_fields &fields) noexcept;
+
+    /* Records a stage that began at begin on another thread and ends now, as
+     * an async pair keyed by sender and serial so overlapping calls don't
+     * have to nest. */
+    static void async(const char *stage,
+                      gint64 begin,
+                      int thread,
+                      const gdbus::span_fields &fields) noexcept;
+
+private:
+    const char *m_stage;
+    const gdbus::span_fields &m_fields;
+    gint64 m_begin;
+};
+
+} /* namespace gdbus */
+
+#endif /* GDBUS_CPP_SPAN_HPP */
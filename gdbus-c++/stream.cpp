@@ -0,0 +1,429 @@
+/**
+* SPDX-FileCopyrightText: Copyright 2024 Denis Glazkov <glazzk.off@mail.ru>
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include "stream.hpp"
+#include "error.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <utility>
+
+namespace {
+
+constexpr std::uint32_t end_frame = 0;
+constexpr std::uint32_t error_frame = UINT32_MAX;
+constexpr std::size_t max_error_size = 4096;
+
+std::string errno_message(const std::string &message)
+{
+    return message + ": " + strerror(errno);
+}
+
+void write_all(int fd, const char *data, std::size_t size)
+{
+    while (size > 0) {
+        ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+
+        if (written < 0 && errno == ENOTSOCK) {
+            written = ::write(fd, data, size);
+        }
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            throw gdbus::error(GDBUS_CPP_ERROR_NAME, errno_message("Couldn't write stream chunk"));
+        }
+
+        data += written;
+        size -= static_cast<std::size_t>(written);
+    }
+}
+
+std::size_t read_all(int fd, char *data, std::size_t size)
+{
+    std::size_t total = 0;
+
+    while (total < size) {
+        ssize_t received = ::read(fd, data + total, size - total);
+
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            throw gdbus::error(GDBUS_CPP_ERROR_NAME, errno_message("Couldn't read stream chunk"));
+        }
+
+        if (received == 0) {
+            break;
+        }
+
+        total += static_cast<std::size_t>(received);
+    }
+
+    return total;
+}
+
+void append_size(std::vector<char> &buffer, std::uint32_t size)
+{
+    const char *bytes = reinterpret_cast<const char *>(&size);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(size));
+}
+
+} /* namespace */
+
+namespace gdbus {
+
+stream_writer::stream_writer(int fd, std::size_t chunk_size) noexcept
+    : m_fd(fd)
+    , m_chunk_size(chunk_size)
+{
+    m_chunk.reserve(m_chunk_size);
+}
+
+stream_writer::~stream_writer()
+{
+    if (m_fd >= 0) {
+        try {
+            abort("Stream writer was destroyed before close()");
+        }
+        catch (const gdbus::error &) {
+        }
+    }
+}
+
+stream_writer::stream_writer(stream_writer &&other) noexcept
+    : m_fd(std::exchange(other.m_fd, -1))
+    , m_chunk_size(other.m_chunk_size)
+    , m_chunk(std::move(other.m_chunk))
+{}
+
+stream_writer &stream_writer::operator=(stream_writer &&other) noexcept
+{
+    if (this != std::addressof(other)) {
+        if (m_fd >= 0) {
+            try {
+                abort("Stream writer was replaced before close()");
+            }
+            catch (const gdbus::error &) {
+            }
+        }
+
+        m_fd = std::exchange(other.m_fd, -1);
+        m_chunk_size = other.m_chunk_size;
+        m_chunk = std::move(other.m_chunk);
+    }
+
+    return *this;
+}
+
+stream_writer stream_writer::reply(GDBusMethodInvocation *invocation, std::size_t chunk_size)
+{
+    int fds[2] = {-1, -1};
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+        std::string message = errno_message("Couldn't create stream socket");
+
+        g_dbus_method_invocation_return_dbus_error(invocation, GDBUS_CPP_ERROR_NAME, message.c_str());
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME, message);
+    }
+
+    shutdown(fds[0], SHUT_RD);
+    shutdown(fds[1], SHUT_WR);
+
+    gdbus::pointer<GError> error;
+    gdbus::pointer<GUnixFDList> fd_list = g_unix_fd_list_new();
+    gint handle = g_unix_fd_list_append(fd_list, fds[1], &error);
+    ::close(fds[1]);
+
+    if (handle < 0) {
+        std::string message = std::string("Couldn't pass stream socket: ") + error->message;
+        ::close(fds[0]);
+
+        g_dbus_method_invocation_return_dbus_error(invocation, GDBUS_CPP_ERROR_NAME, message.c_str());
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME, message);
+    }
+
+    g_dbus_method_invocation_return_value_with_unix_fd_list(invocation,
+                                                            g_variant_new("(h)", handle),
+                                                            fd_list);
+
+    return stream_writer(fds[0], chunk_size);
+}
+
+void stream_writer::write(GVariant *item)
+{
+    gdbus::pointer<GVariant> value = g_variant_ref_sink(item);
+    gsize size = g_variant_get_size(value);
+
+    if (size > UINT32_MAX - 2 * sizeof(std::uint32_t)) {
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME, "Stream item exceeds 4GiB");
+    }
+
+    if (!m_chunk.empty() && m_chunk.size() + sizeof(std::uint32_t) + size > m_chunk_size) {
+        flush();
+    }
+
+    append_size(m_chunk, static_cast<std::uint32_t>(size));
+
+    std::size_t offset = m_chunk.size();
+    m_chunk.resize(offset + size);
+    g_variant_store(value, m_chunk.data() + offset);
+
+    if (m_chunk.size() >= m_chunk_size) {
+        flush();
+    }
+}
+
+void stream_writer::flush()
+{
+    if (m_chunk.empty() || m_fd < 0) {
+        return;
+    }
+
+    if (m_chunk.size() >= error_frame) {
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME, "Stream chunk exceeds 4GiB");
+    }
+
+    auto size = static_cast<std::uint32_t>(m_chunk.size());
+
+    write_all(m_fd, reinterpret_cast<const char *>(&size), sizeof(size));
+    write_all(m_fd, m_chunk.data(), m_chunk.size());
+    m_chunk.clear();
+}
+
+void stream_writer::close()
+{
+    if (m_fd < 0) {
+        return;
+    }
+
+    try {
+        flush();
+
+        std::uint32_t end = end_frame;
+        write_all(m_fd, reinterpret_cast<const char *>(&end), sizeof(end));
+    }
+    catch (const gdbus::error &) {
+        ::close(std::exchange(m_fd, -1));
+        throw;
+    }
+
+    ::close(std::exchange(m_fd, -1));
+}
+
+void stream_writer::abort(const std::string &message)
+{
+    if (m_fd < 0) {
+        return;
+    }
+
+    m_chunk.clear();
+
+    std::vector<char> frame;
+    std::size_t size = std::min(message.size(), max_error_size);
+
+    append_size(frame, error_frame);
+    append_size(frame, static_cast<std::uint32_t>(size));
+    frame.insert(frame.end(), message.begin(), message.begin() + size);
+
+    try {
+        write_all(m_fd, frame.data(), frame.size());
+    }
+    catch (const gdbus::error &) {
+        ::close(std::exchange(m_fd, -1));
+        throw;
+    }
+
+    ::close(std::exchange(m_fd, -1));
+}
+
+stream_reader::stream_reader(int fd, const GVariantType *item_type, std::size_t max_chunk_size)
+    : m_fd(fd)
+    , m_item_type(g_variant_type_copy(item_type))
+    , m_max_chunk_size(max_chunk_size)
+    , m_offset(0)
+{}
+
+stream_reader::~stream_reader()
+{
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+
+    if (m_item_type) {
+        g_variant_type_free(m_item_type);
+    }
+}
+
+stream_reader::stream_reader(stream_reader &&other) noexcept
+    : m_fd(std::exchange(other.m_fd, -1))
+    , m_item_type(std::exchange(other.m_item_type, nullptr))
+    , m_max_chunk_size(other.m_max_chunk_size)
+    , m_chunk(std::move(other.m_chunk))
+    , m_offset(other.m_offset)
+{}
+
+stream_reader &stream_reader::operator=(stream_reader &&other) noexcept
+{
+    if (this != std::addressof(other)) {
+        std::swap(m_fd, other.m_fd);
+        std::swap(m_item_type, other.m_item_type);
+        std::swap(m_max_chunk_size, other.m_max_chunk_size);
+        std::swap(m_chunk, other.m_chunk);
+        std::swap(m_offset, other.m_offset);
+    }
+
+    return *this;
+}
+
+stream_reader stream_reader::call(GDBusConnection *connection,
+                                  const char *destination,
+                                  const char *object_path,
+                                  const char *interface_name,
+                                  const char *method_name,
+                                  GVariant *parameters,
+                                  const GVariantType *item_type,
+                                  std::size_t max_chunk_size)
+{
+    gdbus::pointer<GError> error;
+    gdbus::pointer<GUnixFDList> fd_list;
+    gdbus::pointer<GVariant> reply = g_dbus_connection_call_with_unix_fd_list_sync(
+        connection,
+        destination,
+        object_path,
+        interface_name,
+        method_name,
+        parameters,
+        G_VARIANT_TYPE("(h)"),
+        G_DBUS_CALL_FLAGS_NONE,
+        -1,
+        nullptr,
+        &fd_list,
+        nullptr,
+        &error);
+
+    if (!reply) {
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME,
+                           std::string("Couldn't open stream: ") + error->message);
+    }
+
+    gint handle = -1;
+    g_variant_get(reply, "(h)", &handle);
+
+    int fd = fd_list ? g_unix_fd_list_get(fd_list, handle, &error) : -1;
+
+    if (fd < 0) {
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME, "Stream reply doesn't carry a file descriptor");
+    }
+
+    return stream_reader(fd, item_type, max_chunk_size);
+}
+
+gdbus::pointer<GVariant> stream_reader::next()
+{
+    while (!m_chunk || m_offset == g_bytes_get_size(m_chunk)) {
+        if (!read_chunk()) {
+            return nullptr;
+        }
+    }
+
+    gsize chunk_size = 0;
+    const char *data = static_cast<const char *>(g_bytes_get_data(m_chunk, &chunk_size));
+    std::uint32_t size = 0;
+
+    if (chunk_size - m_offset < sizeof(size)) {
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME, "Malformed stream chunk");
+    }
+
+    memcpy(&size, data + m_offset, sizeof(size));
+    m_offset += sizeof(size);
+
+    if (chunk_size - m_offset < size) {
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME, "Malformed stream chunk");
+    }
+
+    gdbus::pointer<GBytes> bytes = g_bytes_new_from_bytes(m_chunk, m_offset, size);
+    m_offset += size;
+
+    return g_variant_ref_sink(g_variant_new_from_bytes(m_item_type, bytes, false));
+}
+
+bool stream_reader::read_chunk()
+{
+    if (m_fd < 0) {
+        return false;
+    }
+
+    std::uint32_t size = 0;
+    std::size_t received = read_all(m_fd, reinterpret_cast<char *>(&size), sizeof(size));
+
+    if (received == 0) {
+        fail("Stream ended without an end frame");
+    }
+
+    if (received != sizeof(size)) {
+        fail("Stream ended inside a chunk header");
+    }
+
+    if (size == end_frame) {
+        ::close(std::exchange(m_fd, -1));
+        m_chunk = nullptr;
+        return false;
+    }
+
+    if (size == error_frame) {
+        std::uint32_t message_size = 0;
+
+        if (read_all(m_fd, reinterpret_cast<char *>(&message_size), sizeof(message_size))
+                != sizeof(message_size)
+            || message_size > max_error_size) {
+            fail("Malformed stream error frame");
+        }
+
+        std::string message(message_size, '\0');
+
+        if (read_all(m_fd, message.data(), message.size()) != message.size()) {
+            fail("Malformed stream error frame");
+        }
+
+        fail("Stream aborted by the writer: " + message);
+    }
+
+    if (size > m_max_chunk_size) {
+        fail("Stream chunk of " + std::to_string(size) + " bytes exceeds the limit of "
+             + std::to_string(m_max_chunk_size) + " bytes");
+    }
+
+    auto *payload = static_cast<char *>(g_malloc(size));
+
+    if (read_all(m_fd, payload, size) != size) {
+        g_free(payload);
+        fail("Stream ended inside a chunk");
+    }
+
+    m_chunk = g_bytes_new_take(payload, size);
+    m_offset = 0;
+
+    return true;
+}
+
+void stream_reader::fail(const std::string &message)
+{
+    ::close(std::exchange(m_fd, -1));
+    m_chunk = nullptr;
+
+    throw gdbus::error(GDBUS_CPP_ERROR_NAME, message);
+}
+
+} /* namespace gdbus */
@@ -0,0 +1,105 @@
+/**
+* SPDX-FileCopyrightText: Copyright 2024 Denis Glazkov <glazzk.off@mail.ru>
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef GDBUS_CPP_STREAM_HPP
+#define GDBUS_CPP_STREAM_HPP
+
+#include "common.hpp"
+#include "pointer.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace gdbus {
+
+/* Results too large for a single message are streamed over a socket passed
+ * in the method reply as a '(h)' handle. Items are batched into chunks:
+ *
+ *   chunk: uint32 payload size, then for every item a uint32 size followed
+ *          by the serialized item, all integers in host byte order
+ *   end:   uint32 0, written by close()
+ *   error: uint32 0xffffffff, then a uint32 size and the error message,
+ *          written by abort() and by a writer destroyed before close()
+ *
+ * A stream that ends without an end or error frame is reported as truncated.
+ * Flow control comes from the socket buffer: write() blocks once the reader
+ * falls behind, so producers should run outside of the service main loop.
+ * Readers reject chunks above their max_chunk_size, so an item larger than
+ * that can't be streamed to them. */
+class GDBUS_CPP_EXPORT_CLASS(stream_writer)
+{
+public:
+    static constexpr std::size_t default_chunk_size = 64 * 1024;
+
+    explicit stream_writer(int fd, std::size_t chunk_size = default_chunk_size) noexcept;
+    ~stream_writer();
+
+    stream_writer(stream_writer &&other) noexcept;
+    stream_writer &operator=(stream_writer &&other) noexcept;
+
+    stream_writer(const stream_writer &) = delete;
+    stream_writer &operator=(const stream_writer &) = delete;
+
+    static stream_writer reply(GDBusMethodInvocation *invocation,
+                               std::size_t chunk_size = default_chunk_size);
+
+    void write(GVariant *item);
+    void flush();
+    void close();
+
+    /* Drops unflushed items and fails the stream on the reading side. */
+    void abort(const std::string &message);
+
+private:
+    int m_fd;
+    std::size_t m_chunk_size;
+    std::vector<char> m_chunk;
+};
+
+class GDBUS_CPP_EXPORT_CLASS(stream_reader)
+{
+public:
+    static constexpr std::size_t default_max_chunk_size = 16 * 1024 * 1024;
+
+    stream_reader(int fd,
+                  const GVariantType *item_type,
+                  std::size_t max_chunk_size = default_max_chunk_size);
+    ~stream_reader();
+
+    stream_reader(stream_reader &&other) noexcept;
+    stream_reader &operator=(stream_reader &&other) noexcept;
+
+    stream_reader(const stream_reader &) = delete;
+    stream_reader &operator=(const stream_reader &) = delete;
+
+    static stream_reader call(GDBusConnection *connection,
+                              const char *destination,
+                              const char *object_path,
+                              const char *interface_name,
+                              const char *method_name,
+                              GVariant *parameters,
+                              const GVariantType *item_type,
+                              std::size_t max_chunk_size = default_max_chunk_size);
+
+    /* Returns nullptr once the writer has closed the stream. Throws if the
+     * writer aborted it or it ended without an end frame. */
+    gdbus::pointer<GVariant> next();
+
+private:
+    bool read_chunk();
+    [[noreturn]] void fail(const std::string &message);
+
+private:
+    int m_fd;
+    GVariantType *m_item_type;
+    std::size_t m_max_chunk_size;
+    gdbus::pointer<GBytes> m_chunk;
+    std::size_t m_offset;
+};
+
+} /* namespace gdbus */
+
+#endif /* GDBUS_CPP_STREAM_HPP */
@@ -0,0 +1,217 @@
+/**
+* SPDX-FileCopyrightText: Copyright 2024 Denis Glazkov <glazzk.off@mail.ru>
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include "subscriptions.hpp"
+#include "debugger.hpp"
+
+#include <algorithm>
+
+namespace {
+
+std::string rule_key(const std::string &sender, const std::string &interface_name)
+{
+    return sender + '\n' + interface_name;
+}
+
+void erase_id(std::vector<guint> &ids, guint id) noexcept
+{
+    auto it = std::find(ids.begin(), ids.end(), id);
+
+    if (it != ids.end()) {
+        *it = ids.back();
+        ids.pop_back();
+    }
+}
+
+} /* namespace */
+
+namespace gdbus {
+
+subscriptions::subscriptions(GDBusConnection *connection) noexcept
+    : m_connection(G_DBUS_CONNECTION(g_object_ref(connection)))
+    , m_next_id(1)
+    , m_dispatching(0)
+{}
+
+subscriptions::~subscriptions()
+{
+    for (const auto &[key, rule]: m_rules) {
+        g_dbus_connection_signal_unsubscribe(m_connection, rule->subscription);
+    }
+}
+
+guint subscriptions::subscribe(const std::string &sender,
+                               const std::string &interface_name,
+                               const std::string &object_path,
+                               const std::string &signal_name,
+                               handler callback)
+{
+    std::string key = rule_key(sender, interface_name);
+    auto [it, inserted] = m_rules.try_emplace(key);
+
+    if (inserted) {
+        it->second = std::make_unique<rule>();
+        it->second->owner = this;
+        it->second->refs = 0;
+        it->second->subscription = g_dbus_connection_signal_subscribe(
+            m_connection,
+            sender.empty() ? nullptr : sender.c_str(),
+            interface_name.empty() ? nullptr : interface_name.c_str(),
+            nullptr,
+            nullptr,
+            nullptr,
+            G_DBUS_SIGNAL_FLAGS_NONE,
+            on_dbus_signal,
+            it->second.get(),
+            nullptr);
+
+        gdbus::debugger() << "Signal match rule added"
+                          << "\n   - Sender:    '" << sender << "'"
+                          << "\n   - Interface: '" << interface_name << "'";
+    }
+
+    rule *match = it->second.get();
+    guint id = m_next_id++;
+
+    if (object_path.empty()) {
+        match->any_path.push_back(id);
+    }
+    else {
+        match->by_path[object_path].push_back(id);
+    }
+
+    ++match->refs;
+    m_entries.emplace(id, entry{match, key, object_path, signal_name, std::move(callback), false});
+
+    return id;
+}
+
+void subscriptions::unsubscribe(guint id) noexcept
+{
+    auto it = m_entries.find(id);
+
+    if (it == m_entries.end() || it->second.removed) {
+        return;
+    }
+
+    /* Handlers may unsubscribe while a signal is being delivered, so the
+     * entry is only marked and erased once delivery has finished. */
+    if (m_dispatching > 0) {
+        it->second.removed = true;
+        m_removed.push_back(id);
+        return;
+    }
+
+    erase(it);
+}
+
+void subscriptions::erase(std::unordered_map<guint, entry>::iterator it) noexcept
+{
+    guint id = it->first;
+    entry &subscription = it->second;
+    rule *match = subscription.match;
+
+    if (subscription.object_path.empty()) {
+        erase_id(match->any_path, id);
+    }
+    else {
+        auto path = match->by_path.find(subscription.object_path);
+        erase_id(path->second, id);
+
+        if (path->second.empty()) {
+            match->by_path.erase(path);
+        }
+    }
+
+    if (--match->refs == 0) {
+        g_dbus_connection_signal_unsubscribe(m_connection, match->subscription);
+        m_rules.erase(subscription.rule_key);
+    }
+
+    m_entries.erase(it);
+}
+
+std::size_t subscriptions::size() const noexcept
+{
+    return m_entries.size() - m_removed.size();
+}
+
+std::size_t subscriptions::match_rules() const noexcept
+{
+    return m_rules.size();
+}
+
+void subscriptions::on_dbus_signal(GDBusConnection *,
+                                   const char *sender,
+                                   const char *object_path,
+                                   const char *interface_name,
+                                   const char *signal_name,
+                                   GVariant *parameters,
+                                   gpointer userdata)
+{
+    auto *match = static_cast<rule *>(userdata);
+    match->owner->on_signal(*match, sender, object_path, interface_name, signal_name, parameters);
+}
+
+void subscriptions::on_signal(const rule &rule,
+                              const char *sender,
+                              const char *object_path,
+                              const char *interface_name,
+                              const char *signal_name,
+                              GVariant *parameters) noexcept
+{
+    ++m_dispatching;
+
+    notify(rule.any_path, sender, object_path, interface_name, signal_name, parameters);
+
+    /* Reused so that looking up a long object path doesn't allocate. */
+    m_path_key.assign(object_path);
+    auto path = rule.by_path.find(m_path_key);
+
+    if (path != rule.by_path.end()) {
+        notify(path->second, sender, object_path, interface_name, signal_name, parameters);
+    }
+
+    if (--m_dispatching > 0) {
+        return;
+    }
+
+    for (guint id: m_removed) {
+        erase(m_entries.find(id));
+    }
+
+    m_removed.clear();
+}
+
+void subscriptions::notify(const std::vector<guint> &ids,
+                           const char *sender,
+                           const char *object_path,
+                           const char *interface_name,
+                           const char *signal_name,
+                           GVariant *parameters) noexcept
+{
+    /* Indexed rather than iterated: handlers may subscribe and grow the
+     * vector, and subscriptions made during delivery don't receive it. */
+    for (std::size_t i = 0, count = ids.size(); i < count; ++i) {
+        entry &subscription = m_entries.find(ids[i])->second;
+
+        if (subscription.removed
+            || (!subscription.signal_name.empty() && subscription.signal_name != signal_name)) {
+            continue;
+        }
+
+        try {
+            subscription.callback(sender, object_path, interface_name, signal_name, parameters);
+        }
+        catch (const std::exception &error) {
+            gdbus::debugger() << "Signal handler failed"
+                              << "\n   - Object: '" << object_path << "'"
+                              << "\n   - Signal: '" << signal_name << "'"
+                              << "\n   - Error:  '" << error.what() << "'";
+        }
+    }
+}
+
+} /* namespace gdbus */
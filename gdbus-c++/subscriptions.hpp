@@ -0,0 +1,106 @@
+/**
+* SPDX-FileCopyrightText: Copyright 2024 Denis Glazkov <glazzk.off@mail.ru>
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef GDBUS_CPP_SUBSCRIPTIONS_HPP
+#define GDBUS_CPP_SUBSCRIPTIONS_HPP
+
+#include "common.hpp"
+#include "pointer.hpp"
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gdbus {
+
+/* Signal subscriptions that share a sender and an interface are served by
+ * one bus match rule; incoming signals are routed to handlers through a
+ * local object path index. Handlers run in the thread-default main context
+ * that was active when the first subscription of the rule was made. */
+class GDBUS_CPP_EXPORT_CLASS(subscriptions)
+{
+public:
+    using handler = std::function<void(const char *sender,
+                                       const char *object_path,
+                                       const char *interface_name,
+                                       const char *signal_name,
+                                       GVariant *parameters)>;
+
+    explicit subscriptions(GDBusConnection *connection) noexcept;
+    ~subscriptions();
+
+    subscriptions(const subscriptions &) = delete;
+    subscriptions &operator=(const subscriptions &) = delete;
+
+    /* An empty object path or signal name matches any. */
+    guint subscribe(const std::string &sender,
+                    const std::string &interface_name,
+                    const std::string &object_path,
+                    const std::string &signal_name,
+                    handler callback);
+    void unsubscribe(guint id) noexcept;
+
+    std::size_t size() const noexcept;
+    std::size_t match_rules() const noexcept;
+
+private:
+    struct rule
+    {
+        subscriptions *owner;
+        guint subscription;
+        std::size_t refs;
+        std::unordered_map<std::string, std::vector<guint>> by_path;
+        std::vector<guint> any_path;
+    };
+
+    struct entry
+    {
+        rule *match;
+        std::string rule_key;
+        std::string object_path;
+        std::string signal_name;
+        handler callback;
+        bool removed;
+    };
+
+private:
+    static void on_dbus_signal(GDBusConnection *connection,
+                               const char *sender,
+                               const char *object_path,
+                               const char *interface_name,
+                               const char *signal_name,
+                               GVariant *parameters,
+                               gpointer userdata);
+
+    void on_signal(const rule &rule,
+                   const char *sender,
+                   const char *object_path,
+                   const char *interface_name,
+                   const char *signal_name,
+                   GVariant *parameters) noexcept;
+    void notify(const std::vector<guint> &ids,
+                const char *sender,
+                const char *object_path,
+                const char *interface_name,
+                const char *signal_name,
+                GVariant *parameters) noexcept;
+    void erase(std::unordered_map<guint, entry>::iterator it) noexcept;
+
+private:
+    gdbus::pointer<GDBusConnection> m_connection;
+    guint m_next_id;
+    std::unordered_map<std::string, std::unique_ptr<rule>> m_rules;
+    std::unordered_map<guint, entry> m_entries;
+    std::size_t m_dispatching;
+    std::vector<guint> m_removed;
+    std::string m_path_key;
+};
+
+} /* namespace gdbus */
+
+#endif /* GDBUS_CPP_SUBSCRIPTIONS_HPP */
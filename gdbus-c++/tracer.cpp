@@ -0,0 +1,305 @@
+/**
+* SPDX-FileCopyrightText: Copyright 2024 Denis Glazkov <glazzk.off@mail.ru>
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include "tracer.hpp"
+#include "error.hpp"
+#include "span.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+struct trace_event
+{
+    std::atomic<std::uint64_t> sequence;
+    char phase;
+    const char *stage;
+    gint64 begin;
+    gint64 duration;
+    int thread;
+    guint32 serial;
+    char sender[32];
+    char path[96];
+    char interface[64];
+    char member[48];
+};
+
+struct trace_ring
+{
+    explicit trace_ring(std::size_t capacity)
+        : events(capacity)
+        , head(0)
+        , thread(gdbus::span::current_thread())
+    {}
+
+    std::vector<trace_event> events;
+    std::atomic<std::uint64_t> head;
+    int thread;
+};
+
+std::atomic<bool> tracing_enabled(false);
+std::atomic<std::size_t> ring_capacity(16384);
+
+std::mutex rings_mutex;
+std::vector<std::shared_ptr<trace_ring>> rings;
+
+template<std::size_t Size>
+void copy_field(char (&destination)[Size], const char *source) noexcept
+{
+    if (!source) {
+        destination[0] = '\0';
+        return;
+    }
+
+    std::size_t length = strnlen(source, Size - 1);
+    memcpy(destination, source, length);
+    destination[length] = '\0';
+}
+
+trace_ring &current_ring()
+{
+    thread_local std::shared_ptr<trace_ring> ring;
+
+    if (!ring) {
+        ring = std::make_shared<trace_ring>(ring_capacity);
+
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        rings.push_back(ring);
+    }
+
+    return *ring;
+}
+
+void record(char phase,
+            const char *stage,
+            gint64 begin,
+            gint64 duration,
+            int thread,
+            const gdbus::span_fields &fields) noexcept
+{
+    trace_ring *ring = nullptr;
+
+    try {
+        ring = &current_ring();
+    }
+    catch (...) {
+        return;
+    }
+
+    if (ring->events.empty()) {
+        return;
+    }
+
+    std::uint64_t index = ring->head.load(std::memory_order_relaxed);
+    trace_event &event = ring->events[index % ring->events.size()];
+
+    event.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    event.phase = phase;
+    event.stage = stage;
+    event.begin = begin;
+    event.duration = duration;
+    event.thread = thread ? thread : ring->thread;
+    event.serial = fields.serial;
+    copy_field(event.sender, fields.sender);
+    copy_field(event.path, fields.path);
+    copy_field(event.interface, fields.interface);
+    copy_field(event.member, fields.member);
+
+    event.sequence.store(index + 1, std::memory_order_release);
+    ring->head.store(index + 1, std::memory_order_release);
+}
+
+bool snapshot(const trace_event &event, std::uint64_t sequence, trace_event &copy) noexcept
+{
+    if (event.sequence.load(std::memory_order_acquire) != sequence) {
+        return false;
+    }
+
+    copy.phase = event.phase;
+    copy.stage = event.stage;
+    copy.begin = event.begin;
+    copy.duration = event.duration;
+    copy.thread = event.thread;
+    copy.serial = event.serial;
+    memcpy(copy.sender, event.sender, sizeof(copy.sender));
+    memcpy(copy.path, event.path, sizeof(copy.path));
+    memcpy(copy.interface, event.interface, sizeof(copy.interface));
+    memcpy(copy.member, event.member, sizeof(copy.member));
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return event.sequence.load(std::memory_order_relaxed) == sequence;
+}
+
+void write_json_string(std::ostream &stream, const char *value, bool quoted = true)
+{
+    if (quoted) {
+        stream << '"';
+    }
+
+    for (; *value; ++value) {
+        if (*value == '"' || *value == '\\') {
+            stream << '\\';
+        }
+
+        stream << *value;
+    }
+
+    if (quoted) {
+        stream << '"';
+    }
+}
+
+void write_event(std::ostream &stream, const trace_event &event, pid_t pid)
+{
+    stream << "{\"name\":\"" << event.stage << "\",\"cat\":\"gdbus\",\"ph\":\"" << event.phase
+           << "\",\"ts\":" << event.begin << ",\"pid\":" << pid << ",\"tid\":" << event.thread;
+
+    if (event.phase == 'X') {
+        stream << ",\"dur\":" << event.duration;
+    }
+    else if (event.phase == 'b' || event.phase == 'e') {
+        stream << ",\"id\":\"" << event.serial << '@';
+        write_json_string(stream, event.sender, false);
+        stream << '"';
+    }
+    else {
+        stream << ",\"s\":\"t\"";
+    }
+
+    stream << ",\"args\":{\"sender\":";
+    write_json_string(stream, event.sender);
+    stream << ",\"path\":";
+    write_json_string(stream, event.path);
+    stream << ",\"interface\":";
+    write_json_string(stream, event.interface);
+    stream << ",\"member\":";
+    write_json_string(stream, event.member);
+    stream << ",\"serial\":" << event.serial << "}}";
+}
+
+} /* namespace */
+
+namespace gdbus {
+
+void tracer::enable(std::size_t events_per_thread) noexcept
+{
+    ring_capacity = events_per_thread;
+    tracing_enabled = true;
+}
+
+void tracer::disable() noexcept
+{
+    tracing_enabled = false;
+}
+
+bool tracer::enabled() noexcept
+{
+    return tracing_enabled.load(std::memory_order_relaxed);
+}
+
+std::size_t tracer::memory_usage() noexcept
+{
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    std::size_t usage = rings.capacity() * sizeof(std::shared_ptr<trace_ring>);
+
+    for (const auto &ring: rings) {
+        usage += sizeof(trace_ring) + ring->events.capacity() * sizeof(trace_event);
+    }
+
+    return usage;
+}
+
+void tracer::flush(const std::string &path)
+{
+    std::vector<std::shared_ptr<trace_ring>> snapshot_rings;
+
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        snapshot_rings = rings;
+    }
+
+    std::ofstream stream(path, std::ios::trunc);
+
+    if (!stream) {
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME, "Couldn't open trace file " + path);
+    }
+
+    pid_t pid = getpid();
+    bool first = true;
+    auto copy = std::make_unique<trace_event>();
+
+    stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    for (const auto &ring: snapshot_rings) {
+        std::uint64_t head = ring->head.load(std::memory_order_acquire);
+        std::uint64_t capacity = ring->events.size();
+        std::uint64_t tail = head > capacity ? head - capacity : 0;
+
+        for (std::uint64_t index = tail; index < head; ++index) {
+            if (!snapshot(ring->events[index % capacity], index + 1, *copy)) {
+                continue;
+            }
+
+            stream << (first ? "\n" : ",\n");
+            write_event(stream, *copy, pid);
+            first = false;
+        }
+    }
+
+    stream << "\n]}\n";
+
+    if (!stream) {
+        throw gdbus::error(GDBUS_CPP_ERROR_NAME, "Couldn't write trace file " + path);
+    }
+}
+
+span::span(const char *stage, const gdbus::span_fields &fields) noexcept
+    : m_stage(stage)
+    , m_fields(fields)
+    , m_begin(tracer::enabled() ? g_get_monotonic_time() : 0)
+{}
+
+span::~span()
+{
+    if (m_begin) {
+        record('X', m_stage, m_begin, g_get_monotonic_time() - m_begin, 0, m_fields);
+    }
+}
+
+int span::current_thread() noexcept
+{
+    thread_local int thread = static_cast<int>(syscall(SYS_gettid));
+    return thread;
+}
+
+void span::instant(const char *stage, const gdbus::span_fields &fields) noexcept
+{
+    if (tracer::enabled()) {
+        record('i', stage, g_get_monotonic_time(), 0, 0, fields);
+    }
+}
+
+void span::async(const char *stage,
+                 gint64 begin,
+                 int thread,
+                 const gdbus::span_fields &fields) noexcept
+{
+    if (tracer::enabled()) {
+        record('b', stage, begin, 0, thread, fields);
+        record('e', stage, g_get_monotonic_time(), 0, 0, fields);
+    }
+}
+
+} /* namespace gdbus */
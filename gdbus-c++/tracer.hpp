@@ -0,0 +1,29 @@
+/**
+* SPDX-FileCopyrightText: Copyright 2024 Denis Glazkov <glazzk.off@mail.ru>
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef GDBUS_CPP_TRACER_HPP
+#define GDBUS_CPP_TRACER_HPP
+
+#include "common.hpp"
+
+#include <cstddef>
+#include <string>
+
+namespace gdbus {
+
+class GDBUS_CPP_EXPORT_CLASS(tracer)
+{
+public:
+    static void enable(std::size_t events_per_thread = 16384) noexcept;
+    static void disable() noexcept;
+    static bool enabled() noexcept;
+    static std::size_t memory_usage() noexcept;
+
+    static void flush(const std::string &path);
+};
+
+} /* namespace gdbus */
+
+#endif /* GDBUS_CPP_TRACER_HPP */
@@ -0,0 +1,278 @@
+/**
+* SPDX-FileCopyrightText: Copyright 2024 Denis Glazkov <glazzk.off@mail.ru>
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include "watchdog.hpp"
+#include "common.hpp"
+#include "debugger.hpp"
+#include "error.hpp"
+#include "service.hpp"
+
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <execinfo.h>
+
+#ifndef GDBUS_CPP_STACK_CAPTURE_SIGNAL
+#define GDBUS_CPP_STACK_CAPTURE_SIGNAL (SIGRTMIN + 3)
+#endif
+
+namespace {
+
+constexpr int max_stack_frames = 64;
+
+/* A capture moves from idle to requested in the monitor thread, then to
+ * writing and done in the signal handler. A capture that times out is
+ * taken back to idle unless the handler already started, so a late signal
+ * can't write the frames while they are being symbolized. */
+enum capture_state : int
+{
+    capture_idle,
+    capture_requested,
+    capture_writing,
+    capture_done,
+};
+
+void *captured_frames[max_stack_frames];
+int captured_frames_count = 0;
+std::atomic<int> capture(capture_idle);
+std::mutex capture_mutex;
+
+void on_stack_capture_signal(int)
+{
+    int requested = capture_requested;
+
+    if (!capture.compare_exchange_strong(requested, capture_writing)) {
+        return;
+    }
+
+    captured_frames_count = backtrace(captured_frames, max_stack_frames);
+    capture = capture_done;
+}
+
+void install_stack_capture_handler()
+{
+    static std::once_flag installed;
+
+    std::call_once(installed, []() {
+        struct sigaction previous = {};
+        sigaction(GDBUS_CPP_STACK_CAPTURE_SIGNAL, nullptr, &previous);
+
+        if ((previous.sa_flags & SA_SIGINFO) || previous.sa_handler != SIG_DFL) {
+            throw gdbus::error(GDBUS_CPP_ERROR_NAME,
+                               "Signal " + std::to_string(GDBUS_CPP_STACK_CAPTURE_SIGNAL)
+                                   + " already has a handler, stall stacks can't be captured");
+        }
+
+        /* The first backtrace() call may load libgcc and allocate,
+         * which is not allowed later inside the signal handler. */
+        void *frame = nullptr;
+        backtrace(&frame, 1);
+
+        struct sigaction action = {};
+        action.sa_handler = on_stack_capture_signal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(GDBUS_CPP_STACK_CAPTURE_SIGNAL, &action, nullptr);
+    });
+}
+
+std::vector<std::string> capture_stack(pthread_t thread)
+{
+    std::lock_guard<std::mutex> lock(capture_mutex);
+
+    capture = capture_requested;
+
+    if (pthread_kill(thread, GDBUS_CPP_STACK_CAPTURE_SIGNAL) != 0) {
+        capture = capture_idle;
+        return {};
+    }
+
+    for (int attempt = 0; attempt < 100 && capture != capture_done; ++attempt) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    int requested = capture_requested;
+
+    if (capture.compare_exchange_strong(requested, capture_idle)) {
+        return {};
+    }
+
+    while (capture != capture_done) {
+        std::this_thread::yield();
+    }
+
+    std::vector<std::string> stack;
+    char **symbols = captured_frames_count > 0
+                         ? backtrace_symbols(captured_frames, captured_frames_count)
+                         : nullptr;
+
+    if (symbols) {
+        stack.assign(symbols, symbols + captured_frames_count);
+        free(symbols);
+    }
+
+    capture = capture_idle;
+    return stack;
+}
+
+gboolean on_heartbeat(gpointer userdata)
+{
+    static_cast<gdbus::watchdog *>(userdata)->beat();
+    return G_SOURCE_CONTINUE;
+}
+
+} /* namespace */
+
+namespace gdbus {
+
+watchdog::watchdog(GMainContext *context,
+                   std::chrono::milliseconds threshold,
+                   std::function<void(const gdbus::stall_report &)> callback,
+                   bool capture_stack)
+    : m_threshold(threshold)
+    , m_callback(std::move(callback))
+    , m_capture_stack(capture_stack)
+    , m_heartbeat(nullptr)
+    , m_last_beat(0)
+    , m_loop_thread(pthread_t())
+    , m_stalls(0)
+    , m_sender(nullptr)
+    , m_object_path(nullptr)
+    , m_interface_name(nullptr)
+    , m_method_name(nullptr)
+    , m_stopped(false)
+{
+    if (m_capture_stack) {
+        install_stack_capture_handler();
+    }
+
+    auto interval = std::max(std::chrono::milliseconds(1), m_threshold / 4);
+
+    m_heartbeat = g_timeout_source_new(static_cast<guint>(interval.count()));
+    g_source_set_priority(m_heartbeat, G_PRIORITY_HIGH);
+    g_source_set_callback(m_heartbeat, on_heartbeat, this, nullptr);
+    g_source_attach(m_heartbeat, context);
+
+    m_thread = std::thread(&watchdog::monitor, this);
+}
+
+watchdog::~watchdog()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopped = true;
+    }
+
+    m_wakeup.notify_one();
+    m_thread.join();
+
+    g_source_destroy(m_heartbeat);
+    g_source_unref(m_heartbeat);
+}
+
+void watchdog::beat() noexcept
+{
+    m_loop_thread = pthread_self();
+    m_last_beat = g_get_monotonic_time();
+}
+
+void watchdog::pause() noexcept
+{
+    m_last_beat = 0;
+}
+
+void watchdog::enter(const char *sender,
+                     const char *object_path,
+                     const char *interface_name,
+                     const char *method_name) noexcept
+{
+    std::lock_guard<std::mutex> lock(m_call_mutex);
+
+    m_sender = sender;
+    m_object_path = object_path;
+    m_interface_name = interface_name;
+    m_method_name = method_name;
+}
+
+void watchdog::leave() noexcept
+{
+    std::lock_guard<std::mutex> lock(m_call_mutex);
+
+    m_sender = nullptr;
+    m_object_path = nullptr;
+    m_interface_name = nullptr;
+    m_method_name = nullptr;
+}
+
+std::size_t watchdog::stalls() const noexcept
+{
+    return m_stalls;
+}
+
+void watchdog::monitor()
+{
+    auto interval = std::max(std::chrono::milliseconds(1), m_threshold / 4);
+    gint64 threshold_us = std::chrono::microseconds(m_threshold).count();
+    gint64 reported_beat = 0;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (!m_wakeup.wait_for(lock, interval, [this]() { return m_stopped; })) {
+        gint64 last_beat = m_last_beat;
+
+        if (last_beat == 0 || last_beat == reported_beat) {
+            continue;
+        }
+
+        gint64 stalled_us = g_get_monotonic_time() - last_beat;
+
+        if (stalled_us < threshold_us) {
+            continue;
+        }
+
+        reported_beat = last_beat;
+
+        lock.unlock();
+        report(stalled_us);
+        lock.lock();
+    }
+}
+
+void watchdog::report(gint64 stalled_us)
+{
+    gdbus::stall_report report = {};
+
+    {
+        std::lock_guard<std::mutex> lock(m_call_mutex);
+
+        if (m_method_name) {
+            report.sender = m_sender ? m_sender : "";
+            report.object = m_object_path;
+            report.interface = m_interface_name;
+            report.method = m_method_name;
+        }
+    }
+
+    report.stalled = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::microseconds(stalled_us));
+    report.count = ++m_stalls;
+
+    if (m_capture_stack) {
+        report.stack = capture_stack(m_loop_thread);
+    }
+
+    gdbus::debugger() << "Main loop stalled"
+                      << "\n   - Stalled:   " << report.stalled.count() << "ms"
+                      << "\n   - Sender:    '" << report.sender << "'"
+                      << "\n   - Object:    '" << report.object << "'"
+                      << "\n   - Interface: '" << report.interface << "'"
+                      << "\n   - Method:    '" << report.method << "'";
+
+    if (m_callback) {
+        m_callback(report);
+    }
+}
+
+} /* namespace gdbus */
@@ -0,0 +1,76 @@
+/**
+* SPDX-FileCopyrightText: Copyright 2024 Denis Glazkov <glazzk.off@mail.ru>
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef GDBUS_CPP_WATCHDOG_HPP
+#define GDBUS_CPP_WATCHDOG_HPP
+
+#include <gio/gio.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <pthread.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace gdbus {
+
+struct stall_report;
+
+class watchdog
+{
+public:
+    watchdog(GMainContext *context,
+             std::chrono::milliseconds threshold,
+             std::function<void(const gdbus::stall_report &)> callback,
+             bool capture_stack);
+    ~watchdog();
+
+    watchdog(const watchdog &) = delete;
+    watchdog &operator=(const watchdog &) = delete;
+
+    void beat() noexcept;
+    void pause() noexcept;
+
+    void enter(const char *sender,
+               const char *object_path,
+               const char *interface_name,
+               const char *method_name) noexcept;
+    void leave() noexcept;
+
+    std::size_t stalls() const noexcept;
+
+private:
+    void monitor();
+    void report(gint64 stalled_us);
+
+private:
+    std::chrono::milliseconds m_threshold;
+    std::function<void(const gdbus::stall_report &)> m_callback;
+    bool m_capture_stack;
+
+    GSource *m_heartbeat;
+    std::atomic<gint64> m_last_beat;
+    std::atomic<pthread_t> m_loop_thread;
+    std::atomic<std::size_t> m_stalls;
+
+    std::mutex m_call_mutex;
+    const char *m_sender;
+    const char *m_object_path;
+    const char *m_interface_name;
+    const char *m_method_name;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    bool m_stopped;
+    std::thread m_thread;
+};
+
+} /* namespace gdbus */
+
+#endif /* GDBUS_CPP_WATCHDOG_HPP */
@@ -5,6 +5,7 @@
 
 #include <gdbus-c++/gdbus-c++.hpp>
 #include <iostream>
+#include <unistd.h>
 
 namespace org::example {
 
@@ -20,6 +21,10 @@ struct Greeter: public gdbus::interface
             <arg name="name" type="s" direction="in"/>
             <arg name="greeting" type="s" direction="out"/>
         </method>
+        <method name="SetGreeting">
+            <annotation name="org.gdbuscpp.Policy" value="same-user"/>
+            <arg name="greeting" type="s" direction="in"/>
+        </method>
     </interface>
 </node>
 )xml")
@@ -52,6 +57,13 @@ int main()
                     gdbus::make_interface<org::example::Greeter>(),
                 }),
             })
+            .with_policy("same-user",
+                         [](const gdbus::credentials &credentials) {
+                             return credentials.uid == getuid();
+                         })
+            .on_ready([](const gdbus::startup_timings &timings) {
+                std::cout << "Ready in " << timings.total.count() << "us\n";
+            })
             .start();
     }
     catch (const gdbus::error &error) {
@@ -10,7 +10,9 @@ SCRIPT_ROOT=$(dirname "$SCRIPT_PATH")
 PROJECT_ROOT=$(dirname "$SCRIPT_ROOT")
 SOURCES_ROOT="$PROJECT_ROOT/gdbus-c++"
 SAMPLES_ROOT="$PROJECT_ROOT/samples"
+TOOLS_ROOT="$PROJECT_ROOT/tools"
+TESTS_ROOT="$PROJECT_ROOT/tests"
 
-find "$SOURCES_ROOT" "$SAMPLES_ROOT" \
+find "$SOURCES_ROOT" "$SAMPLES_ROOT" "$TOOLS_ROOT" "$TESTS_ROOT" \
     -regex '.+\.[hc]pp' \
     -exec clang-format-15 --dry-run -Werror {} +;
@@ -10,6 +10,8 @@ SCRIPT_ROOT=$(dirname "$SCRIPT_PATH")
 PROJECT_ROOT=$(dirname "$SCRIPT_ROOT")
 SOURCES_ROOT="$PROJECT_ROOT/gdbus-c++"
 SAMPLES_ROOT="$PROJECT_ROOT/samples"
+TOOLS_ROOT="$PROJECT_ROOT/tools"
+TESTS_ROOT="$PROJECT_ROOT/tests"
 BUILD_ROOT="$PROJECT_ROOT/builddir"
 
 if [ -d "$BUILD_ROOT" ]; then
@@ -18,4 +20,4 @@ fi
 
 meson setup "$BUILD_ROOT" "$PROJECT_ROOT"
 
-clang-tidy-15 -p "$BUILD_ROOT" $(find "$SOURCES_ROOT" "$SAMPLES_ROOT" -regex '.+\.[hc]pp')
+clang-tidy-15 -p "$BUILD_ROOT" $(find "$SOURCES_ROOT" "$SAMPLES_ROOT" "$TOOLS_ROOT" "$TESTS_ROOT" -regex '.+\.[hc]pp')
@@ -0,0 +1,288 @@
+/**
+* SPDX-FileCopyrightText: Copyright 2024 Denis Glazkov <glazzk.off@mail.ru>
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include <gdbus-c++/error.hpp>
+#include <gdbus-c++/stream.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+std::atomic<int> failures = 0;
+
+void expect(bool condition, const std::string &what)
+{
+    if (!condition) {
+        std::cerr << "FAIL: " << what << '\n';
+        ++failures;
+    }
+}
+
+void expect_error(const std::function<void()> &action, const std::string &what)
+{
+    try {
+        action();
+    }
+    catch (const gdbus::error &) {
+        return;
+    }
+
+    expect(false, what);
+}
+
+struct socket_pair
+{
+    socket_pair()
+    {
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+            throw std::runtime_error("Couldn't create socket pair");
+        }
+    }
+
+    ~socket_pair()
+    {
+        for (int fd: fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    int take(int index)
+    {
+        int fd = fds[index];
+        fds[index] = -1;
+        return fd;
+    }
+
+    int fds[2] = {-1, -1};
+};
+
+std::vector<char> join(const std::vector<std::vector<char>> &parts)
+{
+    std::size_t size = 0;
+
+    for (const auto &part: parts) {
+        size += part.size();
+    }
+
+    std::vector<char> bytes(size);
+    auto output = bytes.begin();
+
+    for (const auto &part: parts) {
+        output = std::copy(part.begin(), part.end(), output);
+    }
+
+    return bytes;
+}
+
+std::vector<char> word(std::uint32_t value)
+{
+    std::vector<char> bytes(sizeof(value));
+    memcpy(bytes.data(), &value, sizeof(value));
+    return bytes;
+}
+
+std::vector<char> frame(std::uint32_t size, const std::vector<char> &payload)
+{
+    return join({word(size), payload});
+}
+
+std::vector<char> item(std::uint32_t value)
+{
+    return join({word(sizeof(value)), word(value)});
+}
+
+bool send_bytes(int fd, const std::vector<char> &bytes)
+{
+    return write(fd, bytes.data(), bytes.size()) == ssize_t(bytes.size());
+}
+
+void round_trip()
+{
+    socket_pair pair;
+    gdbus::stream_reader reader(pair.take(1), G_VARIANT_TYPE_UINT32);
+
+    std::thread producer([fd = pair.take(0)]() {
+        gdbus::stream_writer writer(fd, 32);
+
+        for (std::uint32_t i = 0; i < 100; ++i) {
+            writer.write(g_variant_new_uint32(i));
+        }
+
+        writer.close();
+    });
+
+    std::uint32_t expected = 0;
+
+    while (gdbus::pointer<GVariant> value = reader.next()) {
+        expect(g_variant_get_uint32(value) == expected++, "items arrive in order");
+    }
+
+    producer.join();
+    expect(expected == 100, "all items arrive before end of stream");
+}
+
+void partial_reads()
+{
+    socket_pair pair;
+    gdbus::stream_reader reader(pair.take(1), G_VARIANT_TYPE_UINT32);
+
+    std::vector<char> payload = join({item(7), item(8)});
+    std::vector<char> bytes = join({frame(static_cast<std::uint32_t>(payload.size()), payload),
+                                    word(0)});
+
+    std::thread producer([fd = pair.take(0), bytes]() {
+        for (char byte: bytes) {
+            expect(write(fd, &byte, 1) == 1, "split write succeeds");
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+
+        close(fd);
+    });
+
+    gdbus::pointer<GVariant> first = reader.next();
+    gdbus::pointer<GVariant> last = reader.next();
+
+    expect(first && g_variant_get_uint32(first) == 7, "first item survives split reads");
+    expect(last && g_variant_get_uint32(last) == 8, "second item survives split reads");
+    expect(!reader.next(), "stream ends after the last chunk");
+
+    producer.join();
+}
+
+void eof_inside_chunk()
+{
+    socket_pair pair;
+    gdbus::stream_reader reader(pair.take(1), G_VARIANT_TYPE_UINT32);
+
+    expect(send_bytes(pair.fds[0], frame(64, item(1))), "truncated chunk is written");
+    close(pair.take(0));
+
+    expect_error([&]() { reader.next(); }, "end of stream inside a chunk is an error");
+}
+
+void eof_inside_header()
+{
+    socket_pair pair;
+    gdbus::stream_reader reader(pair.take(1), G_VARIANT_TYPE_UINT32);
+
+    expect(send_bytes(pair.fds[0], {0, 0}), "truncated header is written");
+    close(pair.take(0));
+
+    expect_error([&]() { reader.next(); }, "end of stream inside a header is an error");
+}
+
+void oversized_chunk()
+{
+    socket_pair pair;
+    gdbus::stream_reader reader(pair.take(1), G_VARIANT_TYPE_UINT32, 1024);
+
+    expect(send_bytes(pair.fds[0], word(UINT32_MAX - 1)), "oversized header is written");
+
+    expect_error([&]() { reader.next(); }, "chunk above the reader limit is rejected");
+    expect(!reader.next(), "stream is closed after an oversized chunk");
+}
+
+void eof_without_end_frame()
+{
+    socket_pair pair;
+    gdbus::stream_reader reader(pair.take(1), G_VARIANT_TYPE_UINT32);
+
+    std::vector<char> payload = item(5);
+    expect(send_bytes(pair.fds[0], frame(static_cast<std::uint32_t>(payload.size()), payload)),
+           "unterminated chunk is written");
+    close(pair.take(0));
+
+    gdbus::pointer<GVariant> value = reader.next();
+
+    expect(value && g_variant_get_uint32(value) == 5, "items before the cut are delivered");
+    expect_error([&]() { reader.next(); }, "end of stream without an end frame is an error");
+}
+
+void aborted_stream()
+{
+    socket_pair pair;
+    gdbus::stream_reader reader(pair.take(1), G_VARIANT_TYPE_UINT32);
+    gdbus::stream_writer writer(pair.take(0));
+
+    writer.write(g_variant_new_uint32(1));
+    writer.flush();
+    writer.write(g_variant_new_uint32(2));
+    writer.abort("backend went away");
+
+    gdbus::pointer<GVariant> value = reader.next();
+    expect(value && g_variant_get_uint32(value) == 1, "flushed items precede the error");
+
+    try {
+        reader.next();
+        expect(false, "aborted stream is an error");
+    }
+    catch (const gdbus::error &error) {
+        expect(error.message().find("backend went away") != std::string::npos,
+               "error frame carries the writer's message");
+    }
+
+    expect(!reader.next(), "stream is closed after an error frame");
+}
+
+void writer_destroyed_without_close()
+{
+    socket_pair pair;
+    gdbus::stream_reader reader(pair.take(1), G_VARIANT_TYPE_UINT32);
+
+    std::thread producer([fd = pair.take(0)]() {
+        gdbus::stream_writer writer(fd, 32);
+
+        for (std::uint32_t i = 0; i < 10; ++i) {
+            writer.write(g_variant_new_uint32(i));
+        }
+    });
+
+    std::uint32_t received = 0;
+    bool failed = false;
+
+    try {
+        while (gdbus::pointer<GVariant> value = reader.next()) {
+            ++received;
+        }
+    }
+    catch (const gdbus::error &) {
+        failed = true;
+    }
+
+    producer.join();
+
+    expect(failed, "writer destroyed without close() fails the stream");
+    expect(received < 10, "unflushed items of an abandoned writer are dropped");
+}
+
+} /* namespace */
+
+int main()
+{
+    round_trip();
+    partial_reads();
+    eof_inside_chunk();
+    eof_inside_header();
+    oversized_chunk();
+    eof_without_end_frame();
+    aborted_stream();
+    writer_destroyed_without_close();
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,254 @@
+/**
+* SPDX-FileCopyrightText: Copyright 2024 Denis Glazkov <glazzk.off@mail.ru>
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include <gdbus-c++/pointer.hpp>
+#include <gdbus-c++/subscriptions.hpp>
+
+#include <cstddef>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+
+namespace {
+
+const char *const test_interface = "org.gdbus.cpp.Test";
+const char *const marker_interface = "org.gdbus.cpp.Marker";
+
+int failures = 0;
+
+void expect(bool condition, const std::string &what)
+{
+    if (!condition) {
+        std::cerr << "FAIL: " << what << '\n';
+        ++failures;
+    }
+}
+
+gdbus::pointer<GDBusConnection> connect(int fd, GDBusConnectionFlags flags, const char *guid)
+{
+    gdbus::pointer<GError> error;
+    GSocket *socket = g_socket_new_from_fd(fd, &error);
+
+    if (!socket) {
+        close(fd);
+        throw std::runtime_error("Couldn't create socket: " + std::string(error->message));
+    }
+
+    GSocketConnection *stream = g_socket_connection_factory_create_connection(socket);
+    g_object_unref(socket);
+
+    gdbus::pointer<GDBusConnection> connection =
+        g_dbus_connection_new_sync(G_IO_STREAM(stream), guid, flags, nullptr, nullptr, &error);
+    g_object_unref(stream);
+
+    if (!connection) {
+        throw std::runtime_error("Couldn't connect peers: " + std::string(error->message));
+    }
+
+    return connection;
+}
+
+/* Two peer connections over a socket pair, so signals can be delivered
+ * without a message bus. Signals emitted by the server are dispatched to
+ * the subscriptions in a private main context. */
+struct peers
+{
+    peers()
+        : context(g_main_context_new())
+    {
+        int fds[2];
+
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+            throw std::runtime_error("Couldn't create socket pair");
+        }
+
+        gchar *guid = g_dbus_generate_guid();
+        std::exception_ptr server_error;
+
+        std::thread accept([&]() {
+            try {
+                server = connect(fds[0], G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_SERVER, guid);
+            }
+            catch (...) {
+                server_error = std::current_exception();
+            }
+        });
+
+        try {
+            client = connect(fds[1], G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT, nullptr);
+        }
+        catch (...) {
+            accept.join();
+            g_free(guid);
+            throw;
+        }
+
+        accept.join();
+        g_free(guid);
+
+        if (server_error) {
+            std::rethrow_exception(server_error);
+        }
+    }
+
+    void emit(const char *interface_name, const char *object_path, const char *signal_name)
+    {
+        g_dbus_connection_emit_signal(server,
+                                      nullptr,
+                                      object_path,
+                                      interface_name,
+                                      signal_name,
+                                      nullptr,
+                                      nullptr);
+    }
+
+    /* Emits a marker after the signal and runs the context until it arrives,
+     * so every handler of the signal has run by then. */
+    void deliver(const char *object_path, const char *signal_name)
+    {
+        emit(test_interface, object_path, signal_name);
+        emit(marker_interface, "/marker", "Marker");
+
+        gint64 deadline = g_get_monotonic_time() + 5 * G_TIME_SPAN_SECOND;
+        std::size_t expected = markers + 1;
+
+        while (markers < expected && g_get_monotonic_time() < deadline) {
+            g_main_context_iteration(context, FALSE);
+            usleep(1000);
+        }
+
+        expect(markers == expected, "signal is delivered in time");
+    }
+
+    gdbus::pointer<GMainContext> context;
+    gdbus::pointer<GDBusConnection> server;
+    gdbus::pointer<GDBusConnection> client;
+    std::size_t markers = 0;
+};
+
+/* Subscriptions made with the peers' context as the thread default, with a
+ * marker subscription that counts delivered signals. */
+struct subscribed
+{
+    explicit subscribed(peers &peers)
+        : subscriptions(peers.client)
+    {
+        g_main_context_push_thread_default(peers.context);
+        subscriptions.subscribe("", marker_interface, "", "", [&peers](auto...) {
+            ++peers.markers;
+        });
+        g_main_context_pop_thread_default(peers.context);
+    }
+
+    guint subscribe(peers &peers,
+                    const std::string &object_path,
+                    gdbus::subscriptions::handler callback)
+    {
+        g_main_context_push_thread_default(peers.context);
+        guint id =
+            subscriptions.subscribe("", test_interface, object_path, "", std::move(callback));
+        g_main_context_pop_thread_default(peers.context);
+
+        return id;
+    }
+
+    gdbus::subscriptions subscriptions;
+};
+
+void routes_by_object_path()
+{
+    peers peers;
+    subscribed subscribed(peers);
+    std::string long_path = "/org/gdbus/cpp/test/objects/with/a/path/longer/than/any/small/string";
+    int any = 0, first = 0, second = 0;
+
+    subscribed.subscribe(peers, "", [&](auto...) { ++any; });
+    subscribed.subscribe(peers, long_path, [&](auto...) { ++first; });
+    subscribed.subscribe(peers, "/other", [&](auto...) { ++second; });
+
+    expect(subscribed.subscriptions.match_rules() == 2, "subscriptions share a match rule");
+
+    peers.deliver(long_path.c_str(), "Changed");
+
+    expect(any == 1, "any-path handler receives the signal");
+    expect(first == 1, "matching path handler receives the signal");
+    expect(second == 0, "other path handler doesn't receive the signal");
+}
+
+void unsubscribe_during_delivery()
+{
+    peers peers;
+    subscribed subscribed(peers);
+    guint first = 0, second = 0;
+    int first_calls = 0, second_calls = 0;
+
+    /* Whichever handler runs first removes both, so the other one must not
+     * run even though it is part of the same delivery. */
+    auto remove_both = [&]() {
+        subscribed.subscriptions.unsubscribe(first);
+        subscribed.subscriptions.unsubscribe(second);
+        subscribed.subscriptions.unsubscribe(second);
+    };
+
+    first = subscribed.subscribe(peers, "/object", [&](auto...) {
+        ++first_calls;
+        remove_both();
+    });
+    second = subscribed.subscribe(peers, "/object", [&](auto...) {
+        ++second_calls;
+        remove_both();
+    });
+
+    peers.deliver("/object", "Changed");
+
+    expect(first_calls + second_calls == 1, "handler removed during delivery doesn't run");
+    expect(subscribed.subscriptions.size() == 1, "removed subscriptions aren't counted");
+    expect(subscribed.subscriptions.match_rules() == 1, "rule is erased after delivery");
+
+    peers.deliver("/object", "Changed");
+
+    expect(first_calls + second_calls == 1, "removed handlers receive no more signals");
+}
+
+void subscribe_during_delivery()
+{
+    peers peers;
+    subscribed subscribed(peers);
+    int outer = 0, inner = 0;
+    bool added = false;
+
+    subscribed.subscribe(peers, "/object", [&](auto...) {
+        ++outer;
+
+        if (!added) {
+            added = true;
+            subscribed.subscribe(peers, "/object", [&](auto...) { ++inner; });
+        }
+    });
+
+    peers.deliver("/object", "Changed");
+
+    expect(outer == 1 && inner == 0, "handler added during delivery waits for the next signal");
+
+    peers.deliver("/object", "Changed");
+
+    expect(outer == 2 && inner == 1, "handler added during delivery receives the next signal");
+}
+
+} /* namespace */
+
+int main()
+{
+    routes_by_object_path();
+    unsubscribe_during_delivery();
+    subscribe_during_delivery();
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,327 @@
+/**
+* SPDX-FileCopyrightText: Copyright 2024 Denis Glazkov <glazzk.off@mail.ru>
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include <gdbus-c++/pointer.hpp>
+#include <gdbus-c++/recorder.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct captured_call
+{
+    gint64 timestamp_us;
+    std::string destination;
+    std::string path;
+    std::string interface;
+    std::string member;
+    std::string signature;
+    std::string body;
+};
+
+struct options
+{
+    std::string capture;
+    std::string address;
+    std::string destination;
+    GBusType bus_type = G_BUS_TYPE_SESSION;
+    double rate = 1.0;
+    std::size_t window = 64;
+};
+
+struct replay
+{
+    GDBusConnection *connection;
+    GMainLoop *mainloop;
+    const options *settings;
+    std::vector<captured_call> calls;
+    std::vector<gint64> latencies;
+    std::size_t next;
+    std::size_t outstanding;
+    std::size_t errors;
+    gint64 started;
+    guint timer;
+};
+
+struct pending_call
+{
+    replay *state;
+    gint64 issued;
+};
+
+std::string read_field(std::ifstream &stream, std::size_t size)
+{
+    std::string field(size, '\0');
+    stream.read(field.data(), static_cast<std::streamsize>(size));
+
+    return field;
+}
+
+bool valid_call(const captured_call &call)
+{
+    return g_variant_type_string_is_valid(call.signature.c_str())
+           && g_variant_type_is_tuple(G_VARIANT_TYPE(call.signature.c_str()))
+           && (call.destination.empty() || g_dbus_is_name(call.destination.c_str()))
+           && g_variant_is_object_path(call.path.c_str())
+           && (call.interface.empty() || g_dbus_is_interface_name(call.interface.c_str()))
+           && g_dbus_is_member_name(call.member.c_str());
+}
+
+std::vector<captured_call> read_capture(const std::string &path)
+{
+    std::ifstream stream(path, std::ios::binary);
+
+    if (!stream) {
+        throw std::runtime_error("Couldn't open capture file " + path);
+    }
+
+    char magic[sizeof(gdbus::capture_format::magic)] = {};
+    std::uint32_t version = 0;
+
+    stream.read(magic, sizeof(magic));
+    stream.read(reinterpret_cast<char *>(&version), sizeof(version));
+
+    if (!stream || memcmp(magic, gdbus::capture_format::magic, sizeof(magic)) != 0
+        || version != gdbus::capture_format::version) {
+        throw std::runtime_error(path + " is not a gdbus-c++ capture file");
+    }
+
+    std::vector<captured_call> calls;
+    gdbus::capture_format::record record = {};
+
+    while (stream.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+        captured_call call;
+
+        call.timestamp_us = static_cast<gint64>(record.timestamp_us);
+        stream.ignore(record.sender_size);
+        call.destination = read_field(stream, record.destination_size);
+        call.path = read_field(stream, record.path_size);
+        call.interface = read_field(stream, record.interface_size);
+        call.member = read_field(stream, record.member_size);
+        call.signature = read_field(stream, record.signature_size);
+        call.body = read_field(stream, record.body_size);
+
+        if (!stream) {
+            throw std::runtime_error(path + " is truncated");
+        }
+
+        if (!valid_call(call)) {
+            throw std::runtime_error(path + " is malformed");
+        }
+
+        calls.push_back(std::move(call));
+    }
+
+    return calls;
+}
+
+options parse_options(int argc, char **argv)
+{
+    options result;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (argument == "--address" && has_value) {
+            result.address = argv[++i];
+        }
+        else if (argument == "--destination" && has_value) {
+            result.destination = argv[++i];
+        }
+        else if (argument == "--rate" && has_value) {
+            result.rate = std::stod(argv[++i]);
+        }
+        else if (argument == "--window" && has_value) {
+            result.window = std::max<std::size_t>(1, std::stoul(argv[++i]));
+        }
+        else if (argument == "--system") {
+            result.bus_type = G_BUS_TYPE_SYSTEM;
+        }
+        else if (argument == "--session") {
+            result.bus_type = G_BUS_TYPE_SESSION;
+        }
+        else if (result.capture.empty() && argument[0] != '-') {
+            result.capture = argument;
+        }
+        else {
+            throw std::invalid_argument("Unknown argument " + argument);
+        }
+    }
+
+    if (result.capture.empty()) {
+        throw std::invalid_argument("Usage: gdbus-replay <capture> [--address ADDRESS | --session | "
+                                    "--system] [--destination NAME] [--rate FACTOR] [--window N]");
+    }
+
+    return result;
+}
+
+void issue_due_calls(replay *state);
+
+void on_call_finished(GObject *source, GAsyncResult *result, gpointer userdata)
+{
+    auto *pending = static_cast<pending_call *>(userdata);
+    replay *state = pending->state;
+
+    gdbus::pointer<GError> error;
+    gdbus::pointer<GVariant> reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source),
+                                                                   result,
+                                                                   &error);
+    if (reply) {
+        state->latencies.push_back(g_get_monotonic_time() - pending->issued);
+    }
+    else {
+        ++state->errors;
+    }
+
+    --state->outstanding;
+    delete pending;
+
+    issue_due_calls(state);
+}
+
+gboolean on_next_call_due(gpointer userdata)
+{
+    auto *state = static_cast<replay *>(userdata);
+
+    state->timer = 0;
+    issue_due_calls(state);
+
+    return G_SOURCE_REMOVE;
+}
+
+void issue_due_calls(replay *state)
+{
+    const options &settings = *state->settings;
+    gint64 now = g_get_monotonic_time();
+
+    while (state->next < state->calls.size() && state->outstanding < settings.window) {
+        const captured_call &call = state->calls[state->next];
+        gint64 due = settings.rate > 0 ? state->started
+                                             + static_cast<gint64>(call.timestamp_us / settings.rate)
+                                       : now;
+        if (due > now) {
+            if (!state->timer) {
+                state->timer = g_timeout_add(static_cast<guint>((due - now + 999) / 1000),
+                                             on_next_call_due,
+                                             state);
+            }
+
+            return;
+        }
+
+        const std::string &destination = settings.destination.empty() ? call.destination
+                                                                       : settings.destination;
+        GVariant *parameters = g_variant_new_from_data(G_VARIANT_TYPE(call.signature.c_str()),
+                                                       call.body.data(),
+                                                       call.body.size(),
+                                                       false,
+                                                       nullptr,
+                                                       nullptr);
+
+        g_dbus_connection_call(state->connection,
+                               destination.empty() ? nullptr : destination.c_str(),
+                               call.path.c_str(),
+                               call.interface.empty() ? nullptr : call.interface.c_str(),
+                               call.member.c_str(),
+                               parameters,
+                               nullptr,
+                               G_DBUS_CALL_FLAGS_NONE,
+                               -1,
+                               nullptr,
+                               on_call_finished,
+                               new pending_call{state, now});
+
+        ++state->outstanding;
+        ++state->next;
+    }
+
+    if (state->next == state->calls.size() && state->outstanding == 0) {
+        g_main_loop_quit(state->mainloop);
+    }
+}
+
+gint64 percentile(const std::vector<gint64> &sorted, double fraction)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+
+    auto index = static_cast<std::size_t>(fraction * static_cast<double>(sorted.size() - 1));
+    return sorted[index];
+}
+
+} /* namespace */
+
+int main(int argc, char **argv)
+{
+    try {
+        options settings = parse_options(argc, argv);
+
+        std::vector<captured_call> calls = read_capture(settings.capture);
+        gdbus::pointer<GError> error;
+        gdbus::pointer<GDBusConnection> connection;
+
+        if (!settings.address.empty()) {
+            connection = g_dbus_connection_new_for_address_sync(
+                settings.address.c_str(),
+                GDBusConnectionFlags(G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT
+                                     | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION),
+                nullptr,
+                nullptr,
+                &error);
+        }
+        else {
+            connection = g_bus_get_sync(settings.bus_type, nullptr, &error);
+        }
+
+        if (!connection) {
+            throw std::runtime_error(std::string("Couldn't connect to bus: ")
+                                     + (error ? error->message : "unknown error"));
+        }
+
+        gdbus::pointer<GMainLoop> mainloop = g_main_loop_new(nullptr, false);
+
+        replay state = {};
+        state.connection = connection;
+        state.mainloop = mainloop;
+        state.settings = &settings;
+        state.calls = std::move(calls);
+        state.latencies.reserve(state.calls.size());
+        state.started = g_get_monotonic_time();
+
+        issue_due_calls(&state);
+
+        if (!state.calls.empty()) {
+            g_main_loop_run(mainloop);
+        }
+
+        double elapsed_s = static_cast<double>(g_get_monotonic_time() - state.started) / 1e6;
+        std::sort(state.latencies.begin(), state.latencies.end());
+
+        std::cout << "Calls:      " << state.calls.size() << "\n"
+                  << "Errors:     " << state.errors << "\n"
+                  << "Elapsed:    " << elapsed_s << "s\n"
+                  << "Throughput: " << (elapsed_s > 0 ? state.calls.size() / elapsed_s : 0)
+                  << " calls/s\n"
+                  << "Latency:    p50 " << percentile(state.latencies, 0.50) << "us, p90 "
+                  << percentile(state.latencies, 0.90) << "us, p99 "
+                  << percentile(state.latencies, 0.99) << "us, max "
+                  << (state.latencies.empty() ? 0 : state.latencies.back()) << "us\n";
+    }
+    catch (const std::exception &error) {
+        std::cout << error.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}